@@ -12,6 +12,8 @@ cd $output_dir
 mkdir -p $job_num
 cd $job_num
 
+# a requeued job continues from its checkpoint, the list must be the same
+rm -f list.txt
 while read line; do
     echo $line >> list.txt
 done < $filelist
@@ -24,8 +26,9 @@ module load compiler/gcc/9
 echo "loading " $ownroot
 source $ownroot
 
-echo "executing $build_dir/analyse -i list.txt -o ag_ag.root"
-$build_dir/analyse -i list.txt -o ag_ag.root -e /lustre/nyx/hades/user/mmamaev/hades_contaminations/efficiency/efficiency_protons_agag158.root
+n_threads=${SLURM_CPUS_PER_TASK:-1}
+echo "executing $build_dir/analyse -i list.txt -o ag_ag.root -t $n_threads"
+$build_dir/analyse -i list.txt -o ag_ag.root -t $n_threads --checkpoint ag_ag.checkpoint.root --resume -e /lustre/nyx/hades/user/mmamaev/hades_contaminations/efficiency/efficiency_protons_agag158.root
 
 #echo "executing $build_dir/analyse -i list.txt -o output.root p 2"
 #$build_dir/analyse -i list.txt -o au_x.root -p 2 -e /lustre/nyx/hades/user/mmamaev/hades_contaminations/efficiency/efficiency_protons_auau123.root -s
@@ -2,6 +2,10 @@
 
 file_list=$1
 output_dir=$2
+# with several cores per job the files of a job are balanced between the threads of analyse,
+# e.g. "run.sh list.txt out 200 16" runs 200 files per job on 16 cores
+files_per_job=${3:-10}
+cpus_per_task=${4:-1}
 
 ownroot=/lustre/nyx/hades/user/mmamaev/install/root-6.18.04/cxx17/bin/thisroot.sh
 
@@ -17,7 +21,7 @@ mkdir -p $output_dir
 mkdir -p $log_dir
 mkdir -p $lists_dir
 
-split -l 10 -d -a 3 --additional-suffix=.list "$file_list" $lists_dir
+split -l $files_per_job -d -a 3 --additional-suffix=.list "$file_list" $lists_dir
 
 n_runs=$(ls $lists_dir/*.list | wc -l)
 
@@ -30,4 +34,4 @@ echo lists_dir=$lists_dir
 echo n_runs=$n_runs
 echo job_range=$job_range
 
-sbatch -J DT_Reader -p $partition -t $time -a $job_range -e ${log_dir}/%A_%a.e -o ${log_dir}/%A_%a.o --export=output_dir=$output_dir,file_list=$file_list,ownroot=$ownroot,lists_dir=$lists_dir,build_dir=$build_dir -- /cvmfs/vae.gsi.de/debian8/containers/debian8-user_container_20210211T1503.sif /lustre/nyx/hades/user/mmamaev/hades_contaminations/batch/batch_run.sh
+sbatch -J DT_Reader -p $partition -t $time -c $cpus_per_task -a $job_range -e ${log_dir}/%A_%a.e -o ${log_dir}/%A_%a.o --export=output_dir=$output_dir,file_list=$file_list,ownroot=$ownroot,lists_dir=$lists_dir,build_dir=$build_dir -- /cvmfs/vae.gsi.de/debian8/containers/debian8-user_container_20210211T1503.sif /lustre/nyx/hades/user/mmamaev/hades_contaminations/batch/batch_run.sh
@@ -0,0 +1,242 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <boost/program_options.hpp>
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TList.h>
+
+#include "analysis_task.h"
+#include "task_runner.h"
+#include "variant_config.h"
+
+/* Micro and macro benchmarks of the analysis:
+ *  efficiency_lookup - EfficiencyTable::GetWeight on random (y, pT),
+ *  fill_event        - AnalysisTask::FillEvent on random event records, no input reading,
+ *  run               - TaskRunner::Run over the input list (reading + AnalysisTask::Exec),
+ *  finish            - TaskRunner::Finish (merging and writing the histograms).
+ * With --golden the output of the last run is compared bin by bin with a reference file,
+ * so an optimization can be checked not to change the results. Before the benchmarks the task is checked
+ * on hand-made events, e.g. that events without protons do not enter the means of proton values. */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double Seconds(Clock::time_point start){
+  return std::chrono::duration<double>(Clock::now()-start).count();
+}
+
+// prints the best and the median time of the repetitions
+void Report(const std::string& name, std::vector<double> times, double n_operations, const std::string& unit){
+  std::sort(times.begin(), times.end());
+  auto best = times.front();
+  auto median = times[times.size()/2];
+  std::cout << name << ": best " << best << " s, median " << median << " s, "
+            << n_operations/best << " " << unit << "/s, " << best/n_operations*1e9 << " ns/" << unit << std::endl;
+}
+
+// returns the number of histograms in the golden file which differ from the output
+int CompareToGolden(const std::string& output_file, const std::string& golden_file){
+  auto output = TFile::Open(output_file.c_str(), "read");
+  auto golden = TFile::Open(golden_file.c_str(), "read");
+  if( !output || !golden )
+    throw std::runtime_error( "Cannot open " + output_file + " or " + golden_file );
+  int n_differences{0};
+  int n_compared{0};
+  TIter next(golden->GetListOfKeys());
+  while( auto key = static_cast<TKey*>(next()) ){
+    auto reference = dynamic_cast<TH1*>( key->ReadObj() );
+    if( !reference )
+      continue;
+    n_compared++;
+    TH1* histo{nullptr};
+    output->GetObject(key->GetName(), histo);
+    if( !histo ){
+      std::cout << "golden: " << key->GetName() << " is missing in the output" << std::endl;
+      n_differences++;
+      continue;
+    }
+    if( histo->GetNcells() != reference->GetNcells() || histo->GetEntries() != reference->GetEntries() ){
+      std::cout << "golden: " << key->GetName() << " has different binning or number of entries" << std::endl;
+      n_differences++;
+      continue;
+    }
+    for( int bin=0; bin<reference->GetNcells(); ++bin ){
+      if( histo->GetBinContent(bin) == reference->GetBinContent(bin) &&
+          histo->GetBinError(bin) == reference->GetBinError(bin) )
+        continue;
+      std::cout << "golden: " << key->GetName() << " differs in bin " << bin << ": "
+                << histo->GetBinContent(bin) << " instead of " << reference->GetBinContent(bin) << std::endl;
+      n_differences++;
+      break;
+    }
+  }
+  output->Close();
+  golden->Close();
+  std::cout << "golden: " << n_compared << " histograms compared, " << n_differences << " differ" << std::endl;
+  return n_differences;
+}
+
+} // namespace
+
+int main(int n_args, char** args){
+  namespace po=boost::program_options;
+  std::string file_list;
+  std::string output_file{"benchmark.root"};
+  std::string efficiency_file{"efficiency/efficiency_protons_agag158.root"};
+  std::string golden_file;
+  std::string histo_storage_name{"dense"};
+  long long n_lookups{100000000};
+  long long n_records{1000000};
+  long long n_events{-1};
+  int n_threads{1};
+  int n_repetitions{3};
+  po::options_description options("Options");
+  options.add_options()
+      ("help,h", "Help screen")
+      ("input,i", po::value<std::string>(&file_list),
+       "Path to input file list, e.g. of files written with generate_tree. Without it only the micro benchmarks run")
+      ("output,o", po::value<std::string>(&output_file),
+       "output file name")
+      ("efficiency,e", po::value<std::string>(&efficiency_file),
+       "Path to file with protons efficiency (ROOT file or binary table)")
+      ("golden", po::value<std::string>(&golden_file),
+       "Reference output to compare the output of the run with")
+      ("lookups", po::value<long long>(&n_lookups),
+       "Number of efficiency lookups in the micro benchmark")
+      ("records", po::value<long long>(&n_records),
+       "Number of events in the histogram filling micro benchmark")
+      ("n-events,N", po::value<long long>(&n_events),
+       "Number of events to process in the run benchmark (-1=all)")
+      ("histo-storage", po::value<std::string>(&histo_storage_name),
+       "Storage of the correlation matrices: dense or sparse")
+      ("threads,t", po::value<int>(&n_threads),
+       "Number of threads of the run benchmark")
+      ("repetitions,r", po::value<int>(&n_repetitions),
+       "Number of repetitions of each benchmark");
+  po::variables_map vm;
+  po::store(po::command_line_parser(n_args, args).options(options).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")){
+    std::cout << options << std::endl;
+    return 0;
+  }
+  if( n_repetitions < 1 )
+    throw std::runtime_error( "Number of repetitions must be positive" );
+  if( histo_storage_name != "dense" && histo_storage_name != "sparse" )
+    throw std::runtime_error( R"(Error in histo-storage value. Only "dense" or "sparse" values are expected)" );
+  auto histo_storage = histo_storage_name == "sparse" ? AnalysisTree::HistoStore::STORAGE::SPARSE
+                                                      : AnalysisTree::HistoStore::STORAGE::DENSE;
+  TH1::AddDirectory(kFALSE);
+  auto efficiencies = std::make_shared<AnalysisTree::EfficiencyTable>();
+  efficiencies->Load(efficiency_file);
+
+  // the inputs are generated with a fixed seed, so the repetitions and the runs are comparable
+  std::mt19937_64 generator(42);
+  {
+    const size_t n_points = 1 << 16;
+    std::uniform_real_distribution<double> y_distribution(-1.0, 1.0);
+    std::uniform_real_distribution<double> pt_distribution(0.0, 2.0);
+    std::uniform_int_distribution<size_t> class_distribution(0, efficiencies->GetNClasses()-1);
+    std::vector<double> y(n_points);
+    std::vector<double> pt(n_points);
+    std::vector<size_t> centrality_class(n_points);
+    for( size_t i=0; i<n_points; ++i ){
+      y[i] = y_distribution(generator);
+      pt[i] = pt_distribution(generator);
+      centrality_class[i] = class_distribution(generator);
+    }
+    std::vector<double> times;
+    volatile double sink{0.0};
+    for( int r=0; r<n_repetitions; ++r ){
+      auto start = Clock::now();
+      double sum{0.0};
+      for( long long i=0; i<n_lookups; ++i ){
+        auto j = static_cast<size_t>(i) & (n_points-1);
+        sum+=efficiencies->GetWeight(centrality_class[j], y[j], pt[j]);
+      }
+      times.push_back(Seconds(start));
+      sink = sum;
+    }
+    (void) sink;
+    Report("efficiency_lookup", times, static_cast<double>(n_lookups), "lookup");
+  }
+  {
+    using Task = AnalysisTree::AnalysisTask;
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::poisson_distribution<int> n_protons_distribution(12.0);
+    std::vector<Task::EventRecord> events(static_cast<size_t>(n_records));
+    std::vector<Task::ProtonRecord> protons;
+    for( auto& event : events ){
+      event = Task::EventRecord{};
+      event.erat = 0.2 + 0.6*unit(generator);
+      event.mean_ycm = unit(generator) - 0.5;
+      for( auto& value : event.track_values )
+        value = unit(generator);
+      for( auto& multiplicity : event.multiplicities )
+        multiplicity = static_cast<int32_t>( 100*unit(generator) );
+      event.vtx_x = unit(generator) - 0.5f;
+      event.vtx_y = unit(generator) - 0.5f;
+      event.vtx_z = -70.0f + 65.0f*unit(generator);
+      event.n_tracks = static_cast<int32_t>( 100*unit(generator) );
+      event.n_pions = event.n_tracks/3;
+      event.n_protons = n_protons_distribution(generator);
+      for( int i=0; i<event.n_protons; ++i )
+        protons.push_back( Task::ProtonRecord{ unit(generator)-0.5, 1.5*unit(generator), 10*unit(generator),
+                                               unit(generator)-0.5f, unit(generator)-0.5f, 0 } );
+    }
+    std::vector<double> times;
+    for( int r=0; r<n_repetitions; ++r ){
+      Task task;
+      task.SetHistoStorage(histo_storage);
+      task.InitHistograms();
+      auto event_protons = protons.data();
+      auto start = Clock::now();
+      for( const auto& event : events ){
+        task.FillEvent(event, event_protons);
+        event_protons+=event.n_protons;
+      }
+      times.push_back(Seconds(start));
+    }
+    Report("fill_event", times, static_cast<double>(n_records), "event");
+  }
+  if( file_list.empty() )
+    return 0;
+
+  std::vector<double> run_times;
+  std::vector<double> finish_times;
+  long long n_processed{0};
+  for( int r=0; r<n_repetitions; ++r ){
+    // the same event selection as analyse without -p and -s
+    AnalysisTree::TaskRunner runner(file_list, "hades_analysis_tree");
+    runner.SetNThreads(n_threads);
+    runner.AddVariant( { "default", AnalysisTree::MakeEventSelection(AnalysisTree::VariantConfig{}),
+                         [efficiencies, histo_storage](){
+                           auto *task = new AnalysisTree::AnalysisTask;
+                           task->SetEfficiencies(efficiencies);
+                           task->SetHistoStorage(histo_storage);
+                           return task;
+                         },
+                         output_file } );
+    runner.Init();
+    n_processed = n_events < 0 || n_events > runner.GetNEntries() ? runner.GetNEntries() : n_events;
+    auto start = Clock::now();
+    runner.Run(n_events);
+    run_times.push_back(Seconds(start));
+    start = Clock::now();
+    runner.Finish();
+    finish_times.push_back(Seconds(start));
+  }
+  Report("run", run_times, static_cast<double>(n_processed), "event");
+  Report("finish", finish_times, 1.0, "finish");
+  if( !golden_file.empty() && CompareToGolden(output_file, golden_file) > 0 )
+    return 1;
+  return 0;
+}
@@ -1,20 +1,154 @@
 #include <iostream>
+#include <atomic>
 #include <chrono>
+#include <exception>
+#include <fstream>
+#include <thread>
 #include <boost/program_options.hpp>
 
-#include <AnalysisTree/TaskManager.hpp>
 #include "analysis_task.h"
+#include "event_cache.h"
+#include "event_index.h"
+#include "output_merger.h"
+#include "task_runner.h"
+#include "variant_config.h"
+
+#include <TROOT.h>
+#include <TSystem.h>
+
+// analyse merge -o merged.root [-t N] (-i list.txt | output_1.root output_2.root ...)
+int Merge(int n_args, char** args){
+  namespace po=boost::program_options;
+  std::string file_list;
+  std::string output_file{"merged.root"};
+  std::vector<std::string> input_files;
+  int n_threads=1;
+  po::options_description options("Merge options");
+  options.add_options()
+      ("help,h", "Help screen")
+      ("input,i", po::value<std::string>(&file_list),
+       "Path to list of outputs to merge")
+      ("output,o", po::value<std::string>(&output_file),
+       "merged output file name")
+      ("threads,t", po::value<int>(&n_threads),
+       "Number of threads merging the outputs")
+      ("input-files", po::value<std::vector<std::string>>(&input_files),
+       "Outputs to merge");
+  po::positional_options_description positional;
+  positional.add("input-files", -1);
+  po::variables_map vm;
+  po::store(po::command_line_parser(n_args, args).options(options).positional(positional).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")){
+    std::cout << options << std::endl;
+    return 0;
+  }
+  if( !file_list.empty() ){
+    std::ifstream list(file_list);
+    if( !list )
+      throw std::runtime_error( "Cannot open file list " + file_list );
+    std::string line;
+    while( std::getline(list, line) )
+      if( !line.empty() )
+        input_files.push_back(line);
+  }
+  AnalysisTree::OutputMerger merger(input_files, output_file);
+  merger.SetNThreads(n_threads);
+  merger.Merge();
+  return 0;
+}
+
+// analyse index -i list.txt [-t N] [--index-dir dir]
+int Index(int n_args, char** args){
+  namespace po=boost::program_options;
+  std::string file_list;
+  std::string index_dir;
+  int n_threads=1;
+  po::options_description options("Index options");
+  options.add_options()
+      ("help,h", "Help screen")
+      ("input,i", po::value<std::string>(&file_list),
+       "Path to input file list")
+      ("index-dir", po::value<std::string>(&index_dir),
+       "Directory to write the indices to instead of next to the input files")
+      ("threads,t", po::value<int>(&n_threads),
+       "Number of files indexed in parallel");
+  po::variables_map vm;
+  po::store(po::command_line_parser(n_args, args).options(options).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")){
+    std::cout << options << std::endl;
+    return 0;
+  }
+  std::ifstream list(file_list);
+  if( !list )
+    throw std::runtime_error( "Cannot open file list " + file_list );
+  std::vector<std::string> input_files;
+  std::string line;
+  while( std::getline(list, line) )
+    if( !line.empty() )
+      input_files.push_back(line);
+  if( !index_dir.empty() )
+    gSystem->mkdir(index_dir.c_str(), kTRUE);
+  ROOT::EnableThreadSafety();
+  std::atomic<size_t> next_file{0};
+  std::atomic<long long> n_entries{0};
+  std::vector<std::thread> threads;
+  std::vector<std::exception_ptr> errors(std::max(n_threads, 1));
+  for( size_t i=0; i<errors.size(); ++i )
+    threads.emplace_back( [i, &input_files, &index_dir, &next_file, &n_entries, &errors](){
+      try {
+        for( auto f = next_file++; f < input_files.size(); f = next_file++ )
+          n_entries+=AnalysisTree::EventIndex::Build( input_files[f], "hades_analysis_tree",
+                                                      AnalysisTree::EventIndex::GetFileName(input_files[f], index_dir) );
+      } catch (...) {
+        errors.at(i) = std::current_exception();
+        next_file = input_files.size();
+      }
+    } );
+  for( auto& thread : threads )
+    thread.join();
+  for( auto& error : errors )
+    if( error )
+      std::rethrow_exception(error);
+  std::cout << input_files.size() << " files with " << n_entries << " entries indexed" << std::endl;
+  return 0;
+}
 
 int main(int n_args, char** args){
   namespace po=boost::program_options;
   if(n_args<2){
     throw std::runtime_error( "Please type \"./acceptance --help\" to get information" );
   }
+  if( std::string(args[1]) == "merge" )
+    return Merge(n_args-1, args+1);
+  if( std::string(args[1]) == "index" )
+    return Index(n_args-1, args+1);
   std::string file_list;
   std::string output_file{"output.root"};
   std::string efficiency_file{"output.root"};
+  std::string efficiency_table_file;
+  std::string event_cache_file;
+  std::string replay_file;
+  std::string histo_storage_name{"dense"};
+  std::string variants_file;
   int physical_trgger{0};
   int n_events=-1;
+  int n_threads=1;
+  long long unit_size=0;
+  std::string checkpoint_file;
+  std::string event_cuts;
+  int checkpoint_interval=1800;
+  size_t read_ahead_files=0;
+  size_t read_ahead_budget=2048;
+  long long tree_cache_size=0;
+  int n_unzip_threads=0;
+  int n_replicas=0;
+  double prescale=1.0;
+  std::string index_dir;
+  std::string bootstrap_mode_name{"poisson"};
+  size_t auto_range_buffer=50000;
+  std::string ranges_file;
   po::options_description options("Options");
   options.add_options()
       ("help,h", "Help screen")
@@ -23,11 +157,57 @@ int main(int n_args, char** args){
       ("output,o", po::value<std::string>(&output_file),
        "output file name")
       ("efficiency,e", po::value<std::string>(&efficiency_file),
-       "Path to file with protons efficiency")
+       "Path to file with protons efficiency (ROOT file or binary table)")
+      ("write-efficiency-table", po::value<std::string>(&efficiency_table_file),
+       "Write protons efficiency as a binary table to be passed with -e instead of the ROOT file")
       ("physical_trigger,p", po::value<int>(&physical_trgger),
        "Physical trigger number (2 or 3)")
       ("n-events,N", po::value<int>(&n_events),
        "Number of events to process (-1=all)")
+      ("prescale", po::value<double>(&prescale),
+       "Fraction of the entries to process, taken reproducibly and uniformly from all the files (1=all)")
+      ("cache", po::value<std::string>(&event_cache_file),
+       "Write the derived per-event values to <cache>.0 in the order of entries for re-histogramming with --replay")
+      ("replay", po::value<std::string>(&replay_file),
+       "Fill the histograms from the event cache <replay>.N instead of reading the input")
+      ("histo-storage", po::value<std::string>(&histo_storage_name),
+       "Storage of the correlation matrices until they are written: dense or sparse")
+      ("bootstrap", po::value<int>(&n_replicas),
+       "Number of replicas for the resampling errors of the mean track values vs multiplicities (0=disabled)")
+      ("bootstrap-mode", po::value<std::string>(&bootstrap_mode_name),
+       "Resampling of the events: poisson (bootstrap) or subsample")
+      ("auto-range", "Decide the axes of the multiplicities and the track values from the first events, "
+                     "written to <output>.ranges")
+      ("auto-range-buffer", po::value<size_t>(&auto_range_buffer),
+       "Number of events each thread buffers before the axes are decided")
+      ("ranges", po::value<std::string>(&ranges_file),
+       "File with the axes written by an --auto-range run, to be used by all the jobs of a production")
+      ("threads,t", po::value<int>(&n_threads),
+       "Number of threads to split the entries between")
+      ("unit-size", po::value<long long>(&unit_size),
+       "Maximal number of entries the threads take from the queue at once (0=automatic)")
+      ("cuts", po::value<std::string>(&event_cuts),
+       "Event cuts as field=min:max or field=value separated with commas, replace the cuts set with -p and -s")
+      ("early-header-columns", "Read only the event header fields used by the cuts before the selection")
+      ("read-ahead", po::value<size_t>(&read_ahead_files),
+       "Number of input files read in background ahead of the event loop (0=disabled)")
+      ("read-ahead-budget", po::value<size_t>(&read_ahead_budget),
+       "Maximal size of the files read ahead, MB")
+      ("tree-cache", po::value<long long>(&tree_cache_size),
+       "Size of the tree cache of each thread, MB (0=ROOT default)")
+      ("unzip-threads", po::value<int>(&n_unzip_threads),
+       "Threads decompressing baskets ahead of the event loop (0=in the event loop)")
+      ("cache-payload", "Prefetch the track and wall baskets with the tree cache too, also for the rejected events")
+      ("checkpoint", po::value<std::string>(&checkpoint_file),
+       "Write the histograms and the processed entries to the file periodically to continue with --resume")
+      ("checkpoint-interval", po::value<int>(&checkpoint_interval),
+       "Seconds between the checkpoints")
+      ("resume", "Continue from the --checkpoint file if it exists")
+      ("event-index", "Skip the entries failing the cuts according to the indices written with analyse index")
+      ("index-dir", po::value<std::string>(&index_dir),
+       "Directory with the indices if they are not next to the input files")
+      ("variants,v", po::value<std::string>(&variants_file),
+       "File with analysis variants (cuts, efficiency, output directory) run in one pass, replaces -p, -s and -e")
       ("start-collisions,s","Selects collisions in START detector");
   po::variables_map vm;
   po::parsed_options parsed = po::command_line_parser(n_args, args).options(options).run();
@@ -39,27 +219,140 @@ int main(int n_args, char** args){
   }
   if( physical_trgger != 2 && physical_trgger != 3 && physical_trgger != 0 )
     throw std::runtime_error( R"(Error in physical trigger set value. Only "2" or "3" values are expected)" );
-  auto is_in_start = vm.count("start-collisions");
-  AnalysisTree::Cuts* evet_cuts;
-  std::vector<AnalysisTree::SimpleCut> vector_of_cuts;
-  vector_of_cuts.emplace_back(AnalysisTree::SimpleCut({"event_header", "selected_mdc_tracks"}, 2.0, 999.0));
-  if( physical_trgger != 0 )
-    vector_of_cuts.emplace_back(AnalysisTree::SimpleCut{ {"event_header", "physical_trigger_"+std::to_string(physical_trgger)}, 1 });
-  if( !is_in_start )
-    vector_of_cuts.emplace_back(AnalysisTree::SimpleCut{ {"event_header", "vtx_z"}, -70.0, -5.0 });
-  else
-    vector_of_cuts.emplace_back(AnalysisTree::SimpleCut{ {"event_header", "vtx_z"}, -90.0, -70.0 });
-
-  evet_cuts = new AnalysisTree::Cuts( "selected_events", vector_of_cuts );
+  if( histo_storage_name != "dense" && histo_storage_name != "sparse" )
+    throw std::runtime_error( R"(Error in histo-storage value. Only "dense" or "sparse" values are expected)" );
+  auto histo_storage = histo_storage_name == "sparse" ? AnalysisTree::HistoStore::STORAGE::SPARSE
+                                                      : AnalysisTree::HistoStore::STORAGE::DENSE;
+  if( !(prescale > 0.0 && prescale <= 1.0) )
+    throw std::runtime_error( "Prescale must be in (0, 1]" );
+  if( n_replicas < 0 || n_replicas == 1 )
+    throw std::runtime_error( "Number of bootstrap replicas must be 0 or at least 2" );
+  auto bootstrap_mode = AnalysisTree::BootstrapProfile::ParseMode(bootstrap_mode_name);
+  auto is_auto_range = vm.count("auto-range") > 0;
+  if( is_auto_range && !ranges_file.empty() )
+    throw std::runtime_error( "--auto-range and --ranges cannot be used together" );
+  if( is_auto_range && auto_range_buffer == 0 )
+    throw std::runtime_error( "Auto-range buffer must hold at least one event" );
+  // a checkpoint writes the histograms, which do not exist before the ranges are decided
+  if( is_auto_range && !checkpoint_file.empty() )
+    throw std::runtime_error( "--auto-range cannot be used with --checkpoint, pass the axes with --ranges" );
+  std::vector<AnalysisTree::Axis> axes;
+  if( !ranges_file.empty() ){
+    axes = AnalysisTree::AutoRange::ReadAxes(ranges_file);
+    AnalysisTree::AnalysisTask().SetAxes(axes); // throws on a missing or unknown axis before the input is read
+  }
+  if( !replay_file.empty() ){
+    TH1::AddDirectory(kFALSE);
+    AnalysisTree::AnalysisTask task;
+    task.SetHistoStorage(histo_storage);
+    task.SetBootstrap(n_replicas, bootstrap_mode);
+    if( !axes.empty() )
+      task.SetAxes(axes);
+    auto auto_range = is_auto_range ? std::make_shared<AnalysisTree::AutoRange>(auto_range_buffer) : nullptr;
+    task.SetAutoRange(auto_range);
+    task.InitHistograms();
+    uint64_t n_replayed{0};
+    // the caches may come from several jobs of one run: the same prescale, the numbers of entries are summed
+    auto cache_files = AnalysisTree::FindEventCacheFiles(replay_file);
+    double sampling_fraction{0.0};
+    uint64_t input_entries{0};
+    uint64_t sampled_entries{0};
+    for( const auto& cache_file : cache_files ){
+      AnalysisTree::EventCacheReader cache(cache_file);
+      if( cache_file != cache_files.front() && cache.GetSamplingFraction() != sampling_fraction )
+        throw std::runtime_error( "Event cache " + cache_file + " was written with a different prescale" );
+      sampling_fraction = cache.GetSamplingFraction();
+      input_entries+=cache.GetInputEntries();
+      sampled_entries+=cache.GetSampledEntries();
+      n_replayed += cache.Replay(task);
+    }
+    std::cout << n_replayed << " events replayed from " << replay_file << std::endl;
+    task.OfferAutoRange();
+    task.ApplyAutoRange();
+    if( auto_range )
+      auto_range->Write( AnalysisTree::AutoRange::GetFileName(output_file) );
+    task.PrintMemoryUsage();
+    auto out_file = TFile::Open(output_file.c_str(), "recreate");
+    if( !out_file )
+      throw std::runtime_error( "Cannot create " + output_file );
+    task.Finish();
+    if( sampling_fraction < 1.0 )
+      AnalysisTree::TaskRunner::WriteSamplingTags(sampling_fraction, input_entries, sampled_entries);
+    out_file->Close();
+    return 0;
+  }
+  std::vector<AnalysisTree::VariantConfig> variants;
+  if( !variants_file.empty() )
+    variants = AnalysisTree::ReadVariantConfigs(variants_file);
+  else {
+    AnalysisTree::VariantConfig variant;
+    variant.physical_trigger = physical_trgger;
+    variant.is_in_start = vm.count("start-collisions");
+    variant.efficiency_file = efficiency_file;
+    variant.cuts = event_cuts;
+    variants.push_back(variant);
+  }
+  if( !efficiency_table_file.empty() && variants.size() > 1 )
+    throw std::runtime_error( "Efficiency table can be written only for a single variant" );
 
-  AnalysisTree::TaskManager manager({file_list}, {"hades_analysis_tree"});
-  manager.SetEventCuts(evet_cuts);
-  auto *analysis_task = new AnalysisTree::AnalysisTask;
-  analysis_task->InitEffieciencies(efficiency_file);
-  manager.AddTask(analysis_task);
-  manager.SetOutFileName(output_file);
-  manager.Init();
-  manager.Run(n_events);
-  manager.Finish();
+  AnalysisTree::TaskRunner runner(file_list, "hades_analysis_tree");
+  runner.SetNThreads(n_threads);
+  runner.SetUnitSize(unit_size);
+  runner.SetPrescale(prescale);
+  runner.SetEventIndex(vm.count("event-index"), index_dir);
+  runner.SetReadAhead(read_ahead_files, read_ahead_budget << 20);
+  runner.SetTreeCacheSize(tree_cache_size << 20);
+  runner.SetUnzipThreads(n_unzip_threads);
+  runner.SetCachePayload(vm.count("cache-payload"));
+  runner.SetEarlyHeaderColumns(vm.count("early-header-columns"));
+  if( vm.count("resume") && checkpoint_file.empty() )
+    throw std::runtime_error( "--resume requires the --checkpoint file" );
+  if( !checkpoint_file.empty() )
+    runner.SetCheckpoint(checkpoint_file, checkpoint_interval);
+  runner.SetResume(vm.count("resume"));
+  runner.SetEventCacheFile(event_cache_file);
+  // variants using the same efficiency file share the table
+  std::map<std::string, std::shared_ptr<const AnalysisTree::EfficiencyTable>> efficiency_tables;
+  // the tasks of each variant share the decided ranges, written next to the output of the variant
+  std::vector<std::pair<std::shared_ptr<AnalysisTree::AutoRange>, std::string>> auto_ranges;
+  for( const auto& variant : variants ){
+    auto& efficiencies = efficiency_tables[variant.efficiency_file];
+    if( !efficiencies ){
+      auto table = std::make_shared<AnalysisTree::EfficiencyTable>();
+      table->Load(variant.efficiency_file);
+      if( !efficiency_table_file.empty() )
+        table->Write(efficiency_table_file);
+      efficiencies = table;
+    }
+    auto out_file_name = output_file;
+    if( !variant.output_dir.empty() ){
+      gSystem->mkdir(variant.output_dir.c_str(), kTRUE);
+      out_file_name = variant.output_dir + "/" + output_file;
+    }
+    std::shared_ptr<AnalysisTree::AutoRange> auto_range;
+    if( is_auto_range ){
+      auto_range = std::make_shared<AnalysisTree::AutoRange>(auto_range_buffer);
+      auto_ranges.emplace_back( auto_range, AnalysisTree::AutoRange::GetFileName(out_file_name) );
+    }
+    runner.AddVariant( { variant.name, AnalysisTree::MakeEventSelection(variant),
+                         [efficiencies, histo_storage, n_replicas, bootstrap_mode, axes, auto_range](){
+                           auto *task = new AnalysisTree::AnalysisTask;
+                           task->SetEfficiencies(efficiencies);
+                           task->SetHistoStorage(histo_storage);
+                           task->SetBootstrap(n_replicas, bootstrap_mode);
+                           if( !axes.empty() )
+                             task->SetAxes(axes);
+                           task->SetAutoRange(auto_range);
+                           return task;
+                         },
+                         out_file_name } );
+  }
+  runner.Init();
+  runner.Run(n_events);
+  runner.Finish();
+  for( const auto& auto_range : auto_ranges ){
+    auto_range.first->Write(auto_range.second);
+    std::cout << "Axis ranges are written to " << auto_range.second << std::endl;
+  }
   return 0;
 }
\ No newline at end of file
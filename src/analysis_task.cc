@@ -4,35 +4,58 @@
 
 #include "analysis_task.h"
 
+#include "event_cache.h"
+
+#include <algorithm>
+#include <iostream>
+
 namespace AnalysisTree {
+AnalysisTask::~AnalysisTask() {
+  delete vtx_z_distribution_;
+  delete n_pions_to_all_tracks_;
+  delete vtx_z_multiplicity_distribution_;
+  delete vtx_z_vtx_r_distribution_;
+  delete vtx_x_vtx_y_distribution_;
+  delete pt_rapidity_chi2_;
+  delete pt_rapidity_dca_xy_;
+  delete pt_rapidity_dca_z_;
+  delete n_tracks_erat_protons_y_;
+  delete correlation_matrices_;
+  for( const auto& profiles : bootstrap_profiles_ )
+    for( auto profile : profiles )
+      delete profile;
+}
+
 void AnalysisTask::Init(std::map<std::string, void *> &branch_map) {
   // linking pointers with branch fields
   event_header_ = static_cast<EventHeader *>(branch_map.at("event_header"));
   mdc_vtx_tracks_ = static_cast<Particles *>(branch_map.at("mdc_vtx_tracks"));
-  meta_hits_ = static_cast<HitDetector *>(branch_map.at("meta_hits"));
   wall_hits_ = static_cast<HitDetector *>(branch_map.at("forward_wall_hits"));
-  mdc_meta_matching_ = static_cast<Matching *>(branch_map.at("mdc_vtx_tracks2meta_hits"));
 
   // getting branch configurations, which store information about fields in branches
   auto event_header_config = config_->GetBranchConfig("event_header");
   auto mdc_vtx_tracks_config = config_->GetBranchConfig("mdc_vtx_tracks");
-  auto meta_hits_config = config_->GetBranchConfig("meta_hits");
   auto wall_hits_config = config_->GetBranchConfig("forward_wall_hits");
 
   // linking necessary for analysis fields with enumerator for fast access to them
-  fields_id_.insert(std::make_pair(FIELDS::HITS_TOF, event_header_config.GetFieldId("selected_tof_hits")));
-  fields_id_.insert(std::make_pair(FIELDS::HITS_RPC, event_header_config.GetFieldId("selected_rpc_hits")));
-  fields_id_.insert(std::make_pair(FIELDS::TRACKS_MDC, event_header_config.GetFieldId("selected_mdc_tracks")));
-  fields_id_.insert(std::make_pair(FIELDS::FW_SIGNAL, event_header_config.GetFieldId("fw_adc")));
-  fields_id_.insert(std::make_pair(FIELDS::PT3, event_header_config.GetFieldId("physical_trigger_3")));
-  fields_id_.insert(std::make_pair(FIELDS::PT2, event_header_config.GetFieldId("physical_trigger_2")));
-  fields_id_.insert(std::make_pair(FIELDS::CHI_2, mdc_vtx_tracks_config.GetFieldId("chi2")));
-  fields_id_.insert(std::make_pair(FIELDS::DCA_XY, mdc_vtx_tracks_config.GetFieldId("dca_xy")));
-  fields_id_.insert(std::make_pair(FIELDS::GEANT_ID, mdc_vtx_tracks_config.GetFieldId("geant_pid")));
-  fields_id_.insert(std::make_pair(FIELDS::DCA_Z, mdc_vtx_tracks_config.GetFieldId("dca_z")));
-  fields_id_.insert(std::make_pair(FIELDS::WALL_RING, wall_hits_config.GetFieldId("ring")));
+  fields_id_.at(Idx(FIELDS::HITS_TOF)) = event_header_config.GetFieldId("selected_tof_hits");
+  fields_id_.at(Idx(FIELDS::HITS_RPC)) = event_header_config.GetFieldId("selected_rpc_hits");
+  fields_id_.at(Idx(FIELDS::TRACKS_MDC)) = event_header_config.GetFieldId("selected_mdc_tracks");
+  fields_id_.at(Idx(FIELDS::FW_SIGNAL)) = event_header_config.GetFieldId("fw_adc");
+  fields_id_.at(Idx(FIELDS::PT3)) = event_header_config.GetFieldId("physical_trigger_3");
+  fields_id_.at(Idx(FIELDS::PT2)) = event_header_config.GetFieldId("physical_trigger_2");
+  fields_id_.at(Idx(FIELDS::CHI_2)) = mdc_vtx_tracks_config.GetFieldId("chi2");
+  fields_id_.at(Idx(FIELDS::DCA_XY)) = mdc_vtx_tracks_config.GetFieldId("dca_xy");
+  fields_id_.at(Idx(FIELDS::GEANT_ID)) = mdc_vtx_tracks_config.GetFieldId("geant_pid");
+  fields_id_.at(Idx(FIELDS::DCA_Z)) = mdc_vtx_tracks_config.GetFieldId("dca_z");
+  fields_id_.at(Idx(FIELDS::WALL_RING)) = wall_hits_config.GetFieldId("ring");
+  fields_id_.at(Idx(FIELDS::CENTRALITY)) = event_header_config.GetFieldId("selected_tof_rpc_hits_centrality");
 
-  // initializing histograms
+  if( !event_stream_ )
+    InitHistograms();
+}
+
+void AnalysisTask::InitHistograms() {
   pt_rapidity_chi2_ = new TProfile2D( "pt_rapidity_chi2", ";y;p_{T};#chi^{2}", 100, -1.0, 1.0, 100, 0.0, 2.0 );
   pt_rapidity_dca_xy_ = new TProfile2D( "pt_rapidity_dca_xy", ";y;p_{T};DCA_{xy}", 100, -1.0, 1.0, 100, 0.0, 2.0 );
   pt_rapidity_dca_z_ = new TProfile2D( "pt_rapidity_dca_z", ";y;p_{T};DCA_{z}", 100, -1.0, 1.0, 100, 0.0, 2.0 );
@@ -41,80 +64,70 @@ void AnalysisTask::Init(std::map<std::string, void *> &branch_map) {
   vtx_z_vtx_r_distribution_ = new TH2F("vtx_z_vtx_r", ";VTX_{z} [mm];#sqrt{VTX_{x}^{2}+VTX_{y}^{2}}", 240, -100.0, 20.0, 250, 0.0, 10.0);
   vtx_z_multiplicity_distribution_ = new TH2F("vtx_z_n_tracks", ";VTX_{z} [mm];Hits TOF+RPC", 240, -100.0, 20.0, 250, 0.0, 250.0);
   vtx_x_vtx_y_distribution_ = new TH2F("vtx_x_vtx_y", ";VTX_{x} [mm];VTX_{y} [mm]", 250, -10.0, 10.0, 250, -10.0, 10.0);
+  // deleted with the task, whatever the current directory is
+  for( TH1* histo : std::initializer_list<TH1*>{ pt_rapidity_chi2_, pt_rapidity_dca_xy_, pt_rapidity_dca_z_,
+                                                 vtx_z_distribution_, n_pions_to_all_tracks_, vtx_z_vtx_r_distribution_,
+                                                 vtx_z_multiplicity_distribution_, vtx_x_vtx_y_distribution_ } )
+    histo->SetDirectory(nullptr);
+  if( !auto_range_ ){
+    InitRangedHistograms();
+    return;
+  }
+  // the ranged histograms are created once the ranges are decided, the events are buffered until then
+  is_range_pending_ = true;
+  sketches_.assign( kNMultiplicities+kNTrackValues, QuantileSketch() );
+  buffered_events_.reserve( auto_range_->GetBufferSize() );
+}
+
+void AnalysisTask::InitRangedHistograms() {
   n_tracks_erat_protons_y_ = Make3DHisto(multiplicities_axes_.at(MULTIPLICITIES::TRACKS_MDC),
                                          track_values_axes_.at(TRACK_VALUES::ERAT),
                                          track_values_axes_.at(TRACK_VALUES::MEAN_YCM));
-  for( const auto& x : multiplicities_axes_ ){
-    std::map<MULTIPLICITIES, TH2F*> x_row;
-    for(const auto& y : multiplicities_axes_){
-      if (x.first == y.first) // to avoid repetitions
-        continue;
-      x_row.insert( {y.first, Make2DHisto(x.second, y.second)} );
-    }
-    multiplicities_matrix_.insert({x.first, x_row});
-  }
-  for( const auto& x : multiplicities_axes_ ){
-    std::map<TRACK_VALUES, TH2F*> x_row;
-    for(const auto& y : track_values_axes_){
-      x_row.insert( {y.first, Make2DHisto(x.second, y.second)} );
-    }
-    multiplicities_track_values_matrix_.insert({x.first, x_row});
-  }
-  for( const auto& x : track_values_axes_ ){
-    std::map<TRACK_VALUES, TH2F*> x_row;
-    for(const auto& y : track_values_axes_){
-      if (x.first == y.first) // to avoid repetitions
-        continue;
-      x_row.insert( {y.first, Make2DHisto(x.second, y.second)} );
+  auto variables = GetAxes();
+  std::vector<CorrelationMatrices::Pair> pairs;
+  for( size_t x=0; x<kNMultiplicities; ++x )
+    for( size_t y=0; y<kNMultiplicities; ++y )
+      if( x != y ) // to avoid repetitions
+        pairs.push_back( {x, y} );
+  for( size_t x=0; x<kNMultiplicities; ++x )
+    for( size_t y=0; y<kNTrackValues; ++y )
+      pairs.push_back( {x, kNMultiplicities+y} );
+  for( size_t x=0; x<kNTrackValues; ++x )
+    for( size_t y=0; y<kNTrackValues; ++y )
+      if( x != y )
+        pairs.push_back( {kNMultiplicities+x, kNMultiplicities+y} );
+  correlation_matrices_ = new CorrelationMatrices( variables, pairs, histo_storage_ );
+  if( n_replicas_ > 0 ){
+    bootstrap_weights_.assign(n_replicas_, 0.0f);
+    for( const auto& x : multiplicities_axes_ ){
+      for(const auto& y : track_values_axes_){
+        bootstrap_profiles_.at(Idx(x.first)).at(Idx(y.first)) =
+            new BootstrapProfile( x.second.name + "_" + y.second.name, ";" + x.second.title + ";" + y.second.title,
+                                  x.second, n_replicas_, bootstrap_mode_ );
+      }
     }
-    track_values_matrix_.insert({x.first, x_row});
   }
-//  this->InitEffieciencies();
 }
 
 void AnalysisTask::Exec() {
-  std::vector<MULTIPLICITIES> mult_keys{
-      MULTIPLICITIES::HITS_TOF,
-      MULTIPLICITIES::HITS_RPC,
-      MULTIPLICITIES::TRACKS_MDC,
-      MULTIPLICITIES::FW_ALL_SIGNAL,
-      MULTIPLICITIES::FW_1_SIGNAL,
-      MULTIPLICITIES::FW_2_SIGNAL,
-      MULTIPLICITIES::FW_3_SIGNAL,
-  };
-  std::vector<TRACK_VALUES> track_val_keys{
-      TRACK_VALUES::ERAT,
-      TRACK_VALUES::PRAT,
-      TRACK_VALUES::MEAN_PT,
-      TRACK_VALUES::MEAN_PZ,
-      TRACK_VALUES::MEAN_Y,
-      TRACK_VALUES::MEAN_THETA,
-      TRACK_VALUES::MEAN_YCM,
-  };
-  std::map<MULTIPLICITIES, int> multiplicities;
-  std::map<TRACK_VALUES, float> track_values;
-  multiplicities.insert(std::make_pair(MULTIPLICITIES::HITS_TOF,event_header_->GetField<int>(fields_id_.at(FIELDS::HITS_TOF)))); // getting multiplicity from event header
-  multiplicities.insert(std::make_pair(MULTIPLICITIES::HITS_RPC,event_header_->GetField<int>(fields_id_.at(FIELDS::HITS_RPC)))); // getting multiplicity from event header
-  multiplicities.insert(std::make_pair(MULTIPLICITIES::TRACKS_MDC,event_header_->GetField<int>(fields_id_.at(FIELDS::TRACKS_MDC)))); // getting multiplicity from event header
-  multiplicities.insert(std::make_pair(MULTIPLICITIES::FW_ALL_SIGNAL,event_header_->GetField<int>(fields_id_.at(FIELDS::FW_SIGNAL)))); // getting multiplicity from event header
-  auto vtx_x = event_header_->GetVertexX();
-  auto vtx_y = event_header_->GetVertexY();
-  auto vtx_z = event_header_->GetVertexZ();
-  auto vtx_r = sqrt(vtx_x*vtx_x+vtx_y*vtx_y);
-  auto centrality = event_header_->GetField<float>(
-      config_->GetBranchConfig( "event_header" ).GetFieldId("selected_tof_rpc_hits_centrality"));
-  auto centrality_class = (size_t) ( (centrality-2.5)/5.0 );
+  // fixed-size storage indexed with enumerators: nothing is allocated per event
+  EventRecord event{};
+  auto& multiplicities = event.multiplicities;
+  auto& track_values = event.track_values;
+  multiplicities[Idx(MULTIPLICITIES::HITS_TOF)] = event_header_->GetField<int>(fields_id_[Idx(FIELDS::HITS_TOF)]); // getting multiplicity from event header
+  multiplicities[Idx(MULTIPLICITIES::HITS_RPC)] = event_header_->GetField<int>(fields_id_[Idx(FIELDS::HITS_RPC)]); // getting multiplicity from event header
+  multiplicities[Idx(MULTIPLICITIES::TRACKS_MDC)] = event_header_->GetField<int>(fields_id_[Idx(FIELDS::TRACKS_MDC)]); // getting multiplicity from event header
+  multiplicities[Idx(MULTIPLICITIES::FW_ALL_SIGNAL)] = event_header_->GetField<int>(fields_id_[Idx(FIELDS::FW_SIGNAL)]); // getting multiplicity from event header
+  event.vtx_x = event_header_->GetVertexX();
+  event.vtx_y = event_header_->GetVertexY();
+  event.vtx_z = event_header_->GetVertexZ();
+  auto centrality = event_header_->GetField<float>(fields_id_[Idx(FIELDS::CENTRALITY)]);
+  auto centrality_class = (centrality-2.5)/5.0;
+  // protons of events out of the efficiency table's centrality classes do not enter the efficiency-weighted sums
+  auto is_efficiency_known = centrality_class > -1.0 && centrality_class < efficiencies_->GetNClasses();
+  auto efficiency_class = is_efficiency_known ? static_cast<size_t>(centrality_class) : 0;
   int n_tracks = mdc_vtx_tracks_->GetNumberOfChannels(); // number of tracks in current event
 
-  vtx_z_distribution_->Fill(vtx_z);
-  vtx_x_vtx_y_distribution_->Fill(vtx_x,vtx_y);
-  vtx_z_vtx_r_distribution_->Fill(vtx_z, vtx_r);
-  vtx_z_multiplicity_distribution_->Fill( vtx_z,
-                                          event_header_->GetField<int>(fields_id_.at(FIELDS::HITS_TOF))+
-                                              event_header_->GetField<int>(fields_id_.at(FIELDS::HITS_RPC)));
-
-  TLorentzVector sum4P{0.0, 0.0, 0.0, 0.0};
-  int n_protons=0;
   double erat_x=0;
   double erat_y=0;
   double prat_x=0;
@@ -133,43 +146,34 @@ void AnalysisTask::Exec() {
   double n_bw_no_eff=0;
   int n_pions = 0;
   int n_helium = 0;
-  for (size_t i = 0; i < n_tracks; ++i) { // loop over all tracks if current event
-    auto track = mdc_vtx_tracks_->GetChannel(i); // getting track from track detector
-    int match_meta_hit = mdc_meta_matching_->GetMatchDirect(i); // getting index of matched with track TOF-system hit
-    auto hit = meta_hits_->GetChannel(i); // getting matched with track hit in TOF-system
-    auto mom4 = track.Get4MomentumByMass( track.GetMass() );
-    auto pid = track.GetPid();
-    sum4P+=mom4;
-    auto pT = mom4.Pt(); // getting transverse momentum
-    auto eta = mom4.Eta(); // getting pseudorapidity
-    auto p = mom4.P(); // getting absolute value of momentum
-    auto y = mom4.Rapidity()-0.74;
-    auto E = mom4.Energy();
-    auto theta = mom4.Theta();
-    mean_pt+=pT;
-    mean_pl+=mom4.Pz();
-    mean_theta+=theta;
-    mean_y+=mom4.Rapidity()*mom4.Rapidity();
-
-    erat_x+=E*cos(theta);
-    erat_y+=E*sin(theta);
-    prat_x+=p*p*cos(theta);
-    prat_y+=p*p*sin(theta);
-    if( abs(pid) == 211 )
-      n_pions++;
-    auto geant_pid = track.GetField<int>(fields_id_.at(FIELDS::GEANT_ID));
-    if( geant_pid == 47  || geant_pid == 49  )
-      n_helium++;
-    if( track.GetPid()!=2212 ) // protons
+  // per-track kinematics of the whole event are computed in columnar passes
+  tracks_.Load(*mdc_vtx_tracks_, fields_id_[Idx(FIELDS::GEANT_ID)]);
+  tracks_.Compute();
+  // event sums are accumulated in the order of tracks to keep the floating point results
+  for (size_t i = 0; i < tracks_.size; ++i) {
+    mean_pt+=tracks_.pt[i];
+    mean_pl+=tracks_.pz[i];
+    mean_theta+=tracks_.theta[i];
+    mean_y+=tracks_.rapidity[i]*tracks_.rapidity[i];
+    erat_x+=tracks_.energy[i]*tracks_.cos_theta[i];
+    erat_y+=tracks_.energy[i]*tracks_.sin_theta[i];
+    prat_x+=tracks_.p[i]*tracks_.p[i]*tracks_.cos_theta[i];
+    prat_y+=tracks_.p[i]*tracks_.p[i]*tracks_.sin_theta[i];
+    n_pions+= abs(tracks_.pid[i]) == 211;
+    n_helium+= tracks_.geant_pid[i] == 47 || tracks_.geant_pid[i] == 49;
+  }
+  STAGE_LAP(stage_stats_, TRACK_LOOP);
+  protons_.clear();
+  for (size_t i = 0; i < tracks_.size; ++i) { // loop over protons of current event
+    if( tracks_.pid[i]!=2212 ) // protons
       continue;
-    auto chi2 = track.GetField<float>(fields_id_.at(FIELDS::CHI_2));
-    auto dca_xy = track.GetField<float>(fields_id_.at(FIELDS::DCA_XY));
-    auto dca_z = track.GetField<float>(fields_id_.at(FIELDS::DCA_Z));
-    // filling distributions
-    pt_rapidity_chi2_->Fill(y, pT, chi2);
-    pt_rapidity_dca_xy_->Fill(y, pT, fabs(dca_xy));
-    pt_rapidity_dca_z_->Fill(y, pT, fabs(dca_z));
-    n_protons++;
+    const auto& track = mdc_vtx_tracks_->GetChannel(i); // getting track from track detector
+    auto pT = tracks_.pt[i]; // transverse momentum
+    auto y = tracks_.rapidity[i]-0.74;
+    auto chi2 = track.GetField<float>(fields_id_[Idx(FIELDS::CHI_2)]);
+    auto dca_xy = track.GetField<float>(fields_id_[Idx(FIELDS::DCA_XY)]);
+    auto dca_z = track.GetField<float>(fields_id_[Idx(FIELDS::DCA_Z)]);
+    protons_.push_back( ProtonRecord{ y, pT, chi2, dca_xy, dca_z, 0 } );
 
     if (-10.0 > dca_xy || dca_xy > 10.0)
       continue;
@@ -177,90 +181,232 @@ void AnalysisTask::Exec() {
       continue;
     if (0.0 > chi2 || chi2 > 100.0)
       continue;
-    try {
-      auto bin = efficiencies_.at(centrality_class)->FindBin(y, pT);
-      auto sim_bin = efficiencies_.at(centrality_class)->FindBin(-y, pT);
-      auto eff = efficiencies_.at(centrality_class)->GetBinContent(bin);
-      auto sim_eff = efficiencies_.at(centrality_class)->GetBinContent(sim_bin);
-      if(eff < 0.1)
-        continue;
-      if(sim_eff < 0.1)
-        continue;
-      sum_w_ycm+= (1.0 / eff) * y;
-      sum_w_ycm_no_eff+= y;
-      sum_w+=(1.0 / eff);
-      sum_w_no_eff+=1.0;
-      if( y>0 ) {
-        n_fw += (1.0 / eff);
-        n_fw_no_eff += 1.0;
-      } else
-        n_bw+=(1.0 / eff);
-        n_bw_no_eff += 1.0;
-    } catch (std::exception&) {}
-  }
-  auto n_modules = wall_hits_->GetNumberOfChannels();
-  float signal_w1=0.0;
-  float signal_w2=0.0;
-  float signal_w3=0.0;
-  for( size_t i=0; i<n_modules; ++i ){
-    auto hit = wall_hits_->GetChannel(i);
-    auto signal = hit.GetSignal();
-    auto ring = hit.GetField<int>(fields_id_.at(FIELDS::WALL_RING));
-    if( ring <= 5 )
-      signal_w1+=signal;
-    if (ring==6 || ring==7)
-      signal_w2+=signal;
-    if(ring >= 8 && ring <= 10)
-      signal_w3+=signal;
+    if( !is_efficiency_known )
+      continue;
+    auto weight = efficiencies_->GetWeight(efficiency_class, y, pT); // 1/efficiency, 0 for low efficiency in (y, pT) or (-y, pT)
+    if( weight == 0.0 )
+      continue;
+    sum_w_ycm+= weight * y;
+    sum_w_ycm_no_eff+= y;
+    sum_w+=weight;
+    sum_w_no_eff+=1.0;
+    if( y>0 ) {
+      n_fw += weight;
+      n_fw_no_eff += 1.0;
+    } else
+      n_bw+=weight;
+      n_bw_no_eff += 1.0;
   }
-  n_pions_to_all_tracks_->Fill( (double) n_pions / (double) n_tracks * 100.0 );
-  multiplicities.insert(std::make_pair(MULTIPLICITIES::FW_1_SIGNAL,signal_w1)); // getting multiplicity from event header
-  multiplicities.insert(std::make_pair(MULTIPLICITIES::FW_2_SIGNAL,signal_w2)); // getting multiplicity from event header
-  multiplicities.insert(std::make_pair(MULTIPLICITIES::FW_3_SIGNAL,signal_w3)); // getting multiplicity from event header
+  STAGE_LAP(stage_stats_, PROTONS);
+  wall_.Load(*wall_hits_, fields_id_[Idx(FIELDS::WALL_RING)]);
+  auto wall_signals = wall_.SumSignals();
+  STAGE_LAP(stage_stats_, WALL_LOOP);
+  auto signal_w1 = wall_signals[WallColumns::W1];
+  auto signal_w2 = wall_signals[WallColumns::W2];
+  auto signal_w3 = wall_signals[WallColumns::W3];
+  multiplicities[Idx(MULTIPLICITIES::FW_1_SIGNAL)] = signal_w1; // getting multiplicity from event header
+  multiplicities[Idx(MULTIPLICITIES::FW_2_SIGNAL)] = signal_w2; // getting multiplicity from event header
+  multiplicities[Idx(MULTIPLICITIES::FW_3_SIGNAL)] = signal_w3; // getting multiplicity from event header
 
   double erat =erat_y/erat_x;
   double prat =prat_y/prat_x;
-  sum4P=sum4P*(1.0/ (double) n_tracks);
   mean_pt/= (double) n_tracks;
   mean_pl/= (double) n_tracks;
   mean_y/= (double) n_tracks;
-  sum_w_ycm = fabs(sum_w) > std::numeric_limits<double>::min() ? sum_w_ycm/sum_w : -999;
-  sum_w_ycm_no_eff = fabs(sum_w_no_eff) > std::numeric_limits<double>::min() ? sum_w_ycm_no_eff/sum_w_no_eff : -999;
+  sum_w_ycm = fabs(sum_w) > std::numeric_limits<double>::min() ? sum_w_ycm/sum_w : kUndefinedValue;
+  sum_w_ycm_no_eff = fabs(sum_w_no_eff) > std::numeric_limits<double>::min() ? sum_w_ycm_no_eff/sum_w_no_eff : kUndefinedValue;
   mean_theta/= (double) n_tracks;
   auto bw_vs_fw = fabs(n_bw) > std::numeric_limits<double>::min() ||
-                          fabs(n_fw) > std::numeric_limits<double>::min() ? n_fw - n_bw  : -999;
+                          fabs(n_fw) > std::numeric_limits<double>::min() ? n_fw - n_bw  : kUndefinedValue;
   auto bw_vs_fw_no_eff = fabs(n_bw_no_eff) > std::numeric_limits<double>::min() ||
-      fabs(n_fw_no_eff) > std::numeric_limits<double>::min() ? n_fw_no_eff - n_bw_no_eff : -999;
-  track_values.insert(std::make_pair( TRACK_VALUES::ERAT, erat ));
-  track_values.insert(std::make_pair( TRACK_VALUES::PRAT, prat ));
-  track_values.insert(std::make_pair( TRACK_VALUES::MEAN_PT, mean_pt ));
-  track_values.insert(std::make_pair( TRACK_VALUES::MEAN_PZ, mean_pl ));
-  track_values.insert(std::make_pair( TRACK_VALUES::MEAN_Y, mean_y ));
-  track_values.insert(std::make_pair( TRACK_VALUES::MEAN_YCM, sum_w_ycm));
-  track_values.insert(std::make_pair( TRACK_VALUES::MEAN_YCM_NO_EFF, sum_w_ycm_no_eff));
-  track_values.insert(std::make_pair( TRACK_VALUES::MEAN_THETA, mean_theta ));
-  track_values.insert(std::make_pair( TRACK_VALUES::FW_VS_BW, bw_vs_fw ));
-  track_values.insert(std::make_pair( TRACK_VALUES::FW_VS_BW_NO_EFF, bw_vs_fw_no_eff ));
-  n_tracks_erat_protons_y_->Fill(n_tracks, erat, sum_w_ycm);
-  for( auto x : multiplicities )
-    for(auto y : multiplicities){
-      if( x.first == y.first )
-        continue;
-      multiplicities_matrix_.at(x.first).at(y.first)->Fill( x.second, y.second );
-    }
-  for( auto x : multiplicities )
-    for(auto y : track_values){
-      multiplicities_track_values_matrix_.at(x.first).at(y.first)->Fill( x.second, y.second );
-    }
-  for( auto x : track_values )
-    for(auto y : track_values){
-      if( x.first == y.first )
+      fabs(n_fw_no_eff) > std::numeric_limits<double>::min() ? n_fw_no_eff - n_bw_no_eff : kUndefinedValue;
+  track_values[Idx(TRACK_VALUES::ERAT)] = erat;
+  track_values[Idx(TRACK_VALUES::PRAT)] = prat;
+  track_values[Idx(TRACK_VALUES::MEAN_PT)] = mean_pt;
+  track_values[Idx(TRACK_VALUES::MEAN_PZ)] = mean_pl;
+  track_values[Idx(TRACK_VALUES::MEAN_Y)] = mean_y;
+  track_values[Idx(TRACK_VALUES::MEAN_YCM)] = sum_w_ycm;
+  track_values[Idx(TRACK_VALUES::MEAN_YCM_NO_EFF)] = sum_w_ycm_no_eff;
+  track_values[Idx(TRACK_VALUES::MEAN_THETA)] = mean_theta;
+  track_values[Idx(TRACK_VALUES::FW_VS_BW)] = bw_vs_fw;
+  track_values[Idx(TRACK_VALUES::FW_VS_BW_NO_EFF)] = bw_vs_fw_no_eff;
+  event.erat = erat;
+  event.mean_ycm = sum_w_ycm;
+  event.n_tracks = n_tracks;
+  event.n_pions = n_pions;
+  event.n_protons = protons_.size();
+
+  if( event_stream_ )
+    event_stream_->Add(event, protons_.data());
+  else
+    FillEvent(event, protons_.data());
+  if( event_cache_ )
+    event_cache_->Write(event, protons_.data());
+  STAGE_LAP(stage_stats_, FILL);
+}
+
+void AnalysisTask::FillStream(const EventStream &stream) {
+  auto protons = stream.protons.data();
+  for( const auto& event : stream.events ){
+    FillEvent(event, protons);
+    if( event_cache_ )
+      event_cache_->Write(event, protons);
+    protons+=event.n_protons;
+  }
+}
+
+void AnalysisTask::FillEvent(const EventRecord &event, const ProtonRecord *protons) {
+  if( is_range_pending_ ){
+    BufferEvent(event, protons);
+    return;
+  }
+  for( int i=0; i<event.n_protons; ++i ){
+    const auto& proton = protons[i];
+    pt_rapidity_chi2_->Fill(proton.y, proton.pT, proton.chi2);
+    pt_rapidity_dca_xy_->Fill(proton.y, proton.pT, fabs(proton.dca_xy));
+    pt_rapidity_dca_z_->Fill(proton.y, proton.pT, fabs(proton.dca_z));
+  }
+  const auto& multiplicities = event.multiplicities;
+  const auto& track_values = event.track_values;
+  auto vtx_r = sqrt(event.vtx_x*event.vtx_x+event.vtx_y*event.vtx_y);
+  vtx_z_distribution_->Fill(event.vtx_z);
+  vtx_x_vtx_y_distribution_->Fill(event.vtx_x,event.vtx_y);
+  vtx_z_vtx_r_distribution_->Fill(event.vtx_z, vtx_r);
+  vtx_z_multiplicity_distribution_->Fill( event.vtx_z,
+                                          multiplicities[Idx(MULTIPLICITIES::HITS_TOF)]+
+                                              multiplicities[Idx(MULTIPLICITIES::HITS_RPC)]);
+  n_pions_to_all_tracks_->Fill( (double) event.n_pions / (double) event.n_tracks * 100.0 );
+  n_tracks_erat_protons_y_->Fill(event.n_tracks, event.erat, event.mean_ycm);
+  std::array<double, kNMultiplicities+kNTrackValues> variables;
+  std::copy( multiplicities.begin(), multiplicities.end(), variables.begin() );
+  std::copy( track_values.begin(), track_values.end(), variables.begin()+kNMultiplicities );
+  correlation_matrices_->Fill( variables.data() );
+  if( n_replicas_ > 0 ){
+    // the weights are a function of the event record only, so the replay of the event cache
+    // and any split of the input between threads and jobs give the same replicas
+    auto weights = bootstrap_weights_.data();
+    BootstrapProfile::GetWeights( BootstrapProfile::GetEventKey(&event, sizeof(event)), bootstrap_mode_, n_replicas_, weights );
+    for( size_t y=0; y<kNTrackValues; ++y ){
+      if( track_values[y] == kUndefinedValue ) // e.g. <y_cm> of an event without protons
         continue;
-      track_values_matrix_.at(x.first).at(y.first)->Fill( x.second, y.second );
+      for( size_t x=0; x<kNMultiplicities; ++x )
+        bootstrap_profiles_[x][y]->Fill( multiplicities[x], track_values[y], weights );
     }
+  }
 }
 
+void AnalysisTask::BufferEvent(const EventRecord &event, const ProtonRecord *protons) {
+  if( auto_range_->IsDecided() ){ // by the task of another thread
+    ApplyAutoRange();
+    FillEvent(event, protons);
+    return;
+  }
+  for( size_t x=0; x<kNMultiplicities; ++x )
+    sketches_[x].Add( event.multiplicities[x] );
+  for( size_t y=0; y<kNTrackValues; ++y )
+    if( event.track_values[y] != kUndefinedValue )
+      sketches_[kNMultiplicities+y].Add( event.track_values[y] );
+  buffered_events_.push_back(event);
+  buffered_protons_.insert( buffered_protons_.end(), protons, protons+event.n_protons );
+  if( buffered_events_.size() < auto_range_->GetBufferSize() )
+    return;
+  auto_range_->Offer(sketches_);
+  ApplyAutoRange();
+}
+
+void AnalysisTask::ApplyAutoRange() {
+  if( !is_range_pending_ )
+    return;
+  std::vector<char> is_integer( kNMultiplicities+kNTrackValues, false );
+  std::fill( is_integer.begin(), is_integer.begin()+kNMultiplicities, true );
+  SetAxes( auto_range_->Decide(GetAxes(), is_integer) );
+  InitRangedHistograms();
+  is_range_pending_ = false;
+  auto protons = buffered_protons_.data();
+  for( const auto& event : buffered_events_ ){
+    FillEvent(event, protons);
+    protons+=event.n_protons;
+  }
+  // releasing the memory of the buffers
+  sketches_ = {};
+  buffered_events_ = {};
+  buffered_protons_ = {};
+}
+
+void AnalysisTask::SetAxes(const std::vector<Axis> &axes) {
+  std::vector<char> is_used(axes.size(), false);
+  auto set_range = [&axes, &is_used](Axis& axis){
+    auto other = std::find_if( axes.begin(), axes.end(), [&axis](const Axis& other){ return other.name == axis.name; } );
+    if( other == axes.end() )
+      throw std::runtime_error( "AnalysisTask: no range of axis " + axis.name + " is given" );
+    is_used[other-axes.begin()] = true;
+    axis.n_bins = other->n_bins;
+    axis.min = other->min;
+    axis.max = other->max;
+  };
+  for( auto& x : multiplicities_axes_ )
+    set_range(x.second);
+  for( auto& x : track_values_axes_ )
+    set_range(x.second);
+  for( size_t i=0; i<axes.size(); ++i )
+    if( !is_used[i] )
+      throw std::runtime_error( "AnalysisTask: unknown axis " + axes[i].name );
+}
+
+std::vector<Axis> AnalysisTask::GetAxes() const {
+  std::vector<Axis> axes;
+  for( const auto& x : multiplicities_axes_ )
+    axes.push_back(x.second);
+  for( const auto& x : track_values_axes_ )
+    axes.push_back(x.second);
+  return axes;
+}
+
+namespace {
+// converts the store to a ROOT histogram and writes it to the current directory
+void WriteHisto(const HistoStore* store){
+  auto histo = store->ToHisto();
+  histo->Write();
+  delete histo;
+}
+// reads the histogram from the directory, the caller owns it
+TH1* ReadStored(TDirectory* directory, const std::string& name){
+  TH1* stored{nullptr};
+  directory->GetObject(name.c_str(), stored);
+  if( !stored )
+    throw std::runtime_error( "Histogram " + name + " is not found in " + directory->GetName() );
+  return stored;
+}
+// adds the histogram of the same name stored in the directory
+void AddStored(TDirectory* directory, TH1* histo){
+  auto stored = ReadStored(directory, histo->GetName());
+  histo->Add(stored);
+  delete stored;
+}
+void AddStored(TDirectory* directory, HistoStore* store){
+  auto stored = ReadStored(directory, store->GetName());
+  store->AddHisto(stored);
+  delete stored;
+}
+void AddStored(TDirectory* directory, BootstrapProfile* profile){
+  auto sum_w = ReadStored(directory, profile->GetSumWName());
+  auto sum_wy = ReadStored(directory, profile->GetSumWYName());
+  profile->AddHistos(sum_w, sum_wy);
+  delete sum_w;
+  delete sum_wy;
+}
+size_t GetMemoryUsage(const HistoStore* store){
+  return store ? store->GetMemoryUsage() : 0;
+}
+// contents, entries and sums of squares of every cell
+size_t GetMemoryUsage(const TProfile2D* profile){
+  return profile ? static_cast<size_t>(profile->GetNcells())*3*sizeof(double) : 0;
+}
+} // namespace
+
 void AnalysisTask::Finish() {
+  if( is_range_pending_ )
+    throw std::runtime_error( "AnalysisTask: the axis ranges are not decided, ApplyAutoRange() has to be called first" );
   // Writing histograms to file
 
   vtx_z_distribution_->Write();
@@ -271,32 +417,89 @@ void AnalysisTask::Finish() {
   pt_rapidity_chi2_->Write();
   pt_rapidity_dca_z_->Write();
   pt_rapidity_dca_xy_->Write();
-  n_tracks_erat_protons_y_->Write();
+  WriteHisto(n_tracks_erat_protons_y_);
 
-  for( const auto& matrices : multiplicities_matrix_ )
-    for( const auto& matrix : matrices.second )
-      matrix.second->Write();
-  for( const auto& matrices : multiplicities_track_values_matrix_)
-    for( const auto& matrix : matrices.second )
-      matrix.second->Write();
-  for( const auto& matrices : track_values_matrix_ )
-    for( const auto& matrix : matrices.second )
-      matrix.second->Write();
+  for( const auto& matrix : correlation_matrices_->ToHistos() )
+    matrix->Write();
+  for( const auto& profiles : bootstrap_profiles_ )
+    for( auto profile : profiles )
+      if( profile )
+        profile->Write();
+  if( n_replicas_ > 0 )
+    BootstrapProfile::WriteModeTag(bootstrap_mode_);
 }
-void AnalysisTask::InitEffieciencies(const std::string& file_name) {
-  const auto& protons_file_name = file_name;
-  file_efficiency_protons_ = TFile::Open(protons_file_name.c_str(), "read");
-  if( !file_efficiency_protons_ )
-    throw std::runtime_error( "Efficiency file not found" );
-  int p=2;
-  while(p<60){
-    efficiencies_.emplace_back();
-    std::string name = "efficiency_"+std::to_string(p);
-    if( file_efficiency_protons_ )
-      file_efficiency_protons_->GetObject(name.c_str(), efficiencies_.back());
-    if( !efficiencies_.back() )
-      throw std::runtime_error( "Efficiency matrix " +name+ " not found" );
-    p+=5;
+void AnalysisTask::Merge(const AnalysisTask &other) {
+  if( is_range_pending_ || other.is_range_pending_ )
+    throw std::runtime_error( "AnalysisTask: cannot merge before the axis ranges are decided" );
+  // the order of additions is fixed by the order of tasks, so the merged result is reproducible
+  vtx_z_distribution_->Add(other.vtx_z_distribution_);
+  n_pions_to_all_tracks_->Add(other.n_pions_to_all_tracks_);
+  vtx_x_vtx_y_distribution_->Add(other.vtx_x_vtx_y_distribution_);
+  vtx_z_vtx_r_distribution_->Add(other.vtx_z_vtx_r_distribution_);
+  vtx_z_multiplicity_distribution_->Add(other.vtx_z_multiplicity_distribution_);
+  pt_rapidity_chi2_->Add(other.pt_rapidity_chi2_);
+  pt_rapidity_dca_z_->Add(other.pt_rapidity_dca_z_);
+  pt_rapidity_dca_xy_->Add(other.pt_rapidity_dca_xy_);
+  n_tracks_erat_protons_y_->Add(other.n_tracks_erat_protons_y_);
+
+  correlation_matrices_->Add(other.correlation_matrices_);
+  for( size_t x=0; x<bootstrap_profiles_.size(); ++x )
+    for( size_t y=0; y<bootstrap_profiles_[x].size(); ++y )
+      if( bootstrap_profiles_[x][y] )
+        bootstrap_profiles_[x][y]->Add( other.bootstrap_profiles_[x][y] );
+}
+
+void AnalysisTask::Restore(TDirectory *directory) {
+  AddStored(directory, vtx_z_distribution_);
+  AddStored(directory, n_pions_to_all_tracks_);
+  AddStored(directory, vtx_x_vtx_y_distribution_);
+  AddStored(directory, vtx_z_vtx_r_distribution_);
+  AddStored(directory, vtx_z_multiplicity_distribution_);
+  AddStored(directory, pt_rapidity_chi2_);
+  AddStored(directory, pt_rapidity_dca_z_);
+  AddStored(directory, pt_rapidity_dca_xy_);
+  AddStored(directory, n_tracks_erat_protons_y_);
+
+  for( size_t pair=0; pair<correlation_matrices_->GetNPairs(); ++pair ){
+    auto stored = ReadStored(directory, correlation_matrices_->GetName(pair));
+    correlation_matrices_->AddHisto(pair, stored);
+    delete stored;
   }
+  if( n_replicas_ > 0 && BootstrapProfile::ReadModeTag(directory) != bootstrap_mode_ )
+    throw std::runtime_error( std::string("AnalysisTask: replicas in ") + directory->GetName() + " are of a different bootstrap mode" );
+  for( const auto& profiles : bootstrap_profiles_ )
+    for( auto profile : profiles )
+      if( profile )
+        AddStored(directory, profile);
+}
+
+void AnalysisTask::PrintMemoryUsage() const {
+  size_t bootstrap_bytes{0};
+  for( const auto& profiles : bootstrap_profiles_ )
+    for( auto profile : profiles )
+      bootstrap_bytes+=profile ? profile->GetMemoryUsage() : 0;
+  // the families of the correlation matrices in the order of the pairs booked in InitRangedHistograms()
+  auto n_multiplicities_pairs = kNMultiplicities*(kNMultiplicities-1);
+  auto n_multiplicities_track_values_pairs = kNMultiplicities*kNTrackValues;
+  auto first_track_values_pair = n_multiplicities_pairs+n_multiplicities_track_values_pairs;
+  auto storage = histo_storage_ == HistoStore::STORAGE::SPARSE ? "sparse" : "dense";
+  std::cout << "Histogram memory (" << storage << " storage), MB:" << std::endl;
+  std::cout << "  pT-y profiles:                       "
+            << (GetMemoryUsage(pt_rapidity_chi2_)+GetMemoryUsage(pt_rapidity_dca_xy_)+GetMemoryUsage(pt_rapidity_dca_z_))/1e6 << std::endl;
+  std::cout << "  multiplicities matrix:               "
+            << correlation_matrices_->GetMemoryUsage(0, n_multiplicities_pairs)/1e6 << std::endl;
+  std::cout << "  multiplicities x track values matrix: "
+            << correlation_matrices_->GetMemoryUsage(n_multiplicities_pairs, first_track_values_pair)/1e6 << std::endl;
+  std::cout << "  track values matrix:                 "
+            << correlation_matrices_->GetMemoryUsage(first_track_values_pair, correlation_matrices_->GetNPairs())/1e6 << std::endl;
+  std::cout << "  " << n_tracks_erat_protons_y_->GetName() << ":     " << GetMemoryUsage(n_tracks_erat_protons_y_)/1e6 << std::endl;
+  if( n_replicas_ > 0 )
+    std::cout << "  bootstrap profiles (" << n_replicas_ << " replicas):    " << bootstrap_bytes/1e6 << std::endl;
+}
+
+void AnalysisTask::InitEffieciencies(const std::string& file_name) {
+  auto efficiencies = std::make_shared<EfficiencyTable>();
+  efficiencies->Load(file_name);
+  efficiencies_ = efficiencies;
 }
-} // namespace AnalysisTree
\ No newline at end of file
+} // namespace AnalysisTree
@@ -5,6 +5,10 @@
 #ifndef QUALITY_ASSURANCE_SRC_TREE_READER_H_
 #define QUALITY_ASSURANCE_SRC_TREE_READER_H_
 
+#include <array>
+#include <cstdint>
+#include <memory>
+
 #include <TChain.h>
 #include <TFile.h>
 #include <TH3F.h>
@@ -16,57 +20,20 @@
 #include <AnalysisTree/Detector.hpp>
 #include <AnalysisTree/Matching.hpp>
 
+#include "auto_range.h"
+#include "bootstrap_profile.h"
+#include "columnar_kernels.h"
+#include "correlation_matrices.h"
+#include "efficiency_table.h"
+#include "histo_store.h"
+#include "stage_stats.h"
+
 namespace AnalysisTree {
 
-struct Axis{
-  std::string name;
-  std::string title;
-  int n_bins;
-  double min;
-  double max;
-};
+class EventCacheWriter;
 
 class AnalysisTask : public FillTask{
 public:
- AnalysisTask() = default;
-  ~AnalysisTask() override = default;
-  void Init( std::map<std::string, void*>& branch_map ) override;
-  void Exec() override;
-  void Finish() override;
-  void InitEffieciencies(const std::string& file_name);
-private:
-  TH2F* Make2DHisto( Axis first, Axis second ){
-    std::string name = first.name + "_" + second.name;
-    std::string title = ";" + first.title + ";"+second.title;
-    auto histo = new TH2F( name.c_str(), title.c_str(),
-                          first.n_bins, first.min, first.max,
-                          second.n_bins, second.min, second.max
-                          );
-    return histo;
-  }
-  TH3F* Make3DHisto( Axis first, Axis second, Axis third ){
-    std::string name = first.name + "_" + second.name+"_"+third.name;
-    std::string title = ";" + first.title + ";"+second.title+ ";"+third.title;
-    auto histo = new TH3F( name.c_str(), title.c_str(),
-                          first.n_bins, first.min, first.max,
-                          second.n_bins, second.min, second.max,
-                          third.n_bins, third.min, third.max
-                          );
-    return histo;
-  }
- enum class FIELDS { // enumerator to fast access to detectors' fields
-    HITS_TOF,         // Hits in TOF-system
-    HITS_RPC,         // Hits in RPC-system
-    TRACKS_MDC,
-    FW_SIGNAL,
-    CHI_2,
-    DCA_XY,
-    DCA_Z,
-    WALL_RING,
-    PT3,
-    PT2,
-    GEANT_ID
-  };
   enum class MULTIPLICITIES {
    HITS_TOF,
    HITS_RPC,
@@ -75,6 +42,7 @@ private:
    FW_1_SIGNAL,
    FW_2_SIGNAL,
    FW_3_SIGNAL,
+   N_MULTIPLICITIES
  };
   enum class TRACK_VALUES {
     PRAT,
@@ -87,8 +55,112 @@ private:
     MEAN_YCM_NO_EFF,
     FW_VS_BW,
     FW_VS_BW_NO_EFF,
+    N_TRACK_VALUES
+  };
+  template<typename E>
+  static constexpr size_t Idx(E e){ return static_cast<size_t>(e); }
+  static constexpr size_t kNMultiplicities = static_cast<size_t>(MULTIPLICITIES::N_MULTIPLICITIES);
+  static constexpr size_t kNTrackValues = static_cast<size_t>(TRACK_VALUES::N_TRACK_VALUES);
+  static constexpr double kUndefinedValue = -999; // track values of events without protons passing the cuts
+  // event-level values everything but the protons' profiles is filled from. Fixed width, no padding:
+  // the records are written as they are to the event cache
+  struct EventRecord{
+    double erat; // ERAT and <y_cm> in double precision for the 3D histogram
+    double mean_ycm;
+    std::array<float, kNTrackValues> track_values;
+    std::array<int32_t, kNMultiplicities> multiplicities;
+    float vtx_x;
+    float vtx_y;
+    float vtx_z;
+    int32_t n_tracks;
+    int32_t n_pions;
+    int32_t n_protons; // number of proton records belonging to the event
+    int32_t reserved;
+  };
+  struct ProtonRecord{
+    double y; // y_cm
+    double pT;
+    float chi2;
+    float dca_xy;
+    float dca_z;
+    int32_t reserved;
+  };
+  // records of consecutive events in the order of entries, to be filled into the histograms of another task
+  struct EventStream{
+    std::vector<EventRecord> events;
+    std::vector<ProtonRecord> protons; // of all the events one after another
+    void Add(const EventRecord& event, const ProtonRecord* event_protons){
+      events.push_back(event);
+      protons.insert(protons.end(), event_protons, event_protons+event.n_protons);
+    }
+  };
+ AnalysisTask() = default;
+  ~AnalysisTask() override; // the task owns its histograms, they are not registered in any directory
+  AnalysisTask(const AnalysisTask&) = delete;
+  AnalysisTask& operator=(const AnalysisTask&) = delete;
+  void Init( std::map<std::string, void*>& branch_map ) override;
+  void Exec() override;
+  void Finish() override;
+  void InitEffieciencies(const std::string& file_name);
+  void SetEfficiencies(std::shared_ptr<const EfficiencyTable> efficiencies) { efficiencies_ = std::move(efficiencies); }
+  // branches read by the task, the others are not deserialized. The event header has to go first:
+  // the rest are loaded only for events passing the event cuts
+  static std::vector<std::string> GetRequiredBranches() { return {"event_header", "mdc_vtx_tracks", "forward_wall_hits"}; }
+  void Merge(const AnalysisTask& other); // adds histograms of the other task filled on a different entry range
+  void Restore(TDirectory* directory); // adds histograms written with Finish() to the directory, e.g. of a checkpoint
+  void InitHistograms(); // called from Init(), or directly when histograms are filled from the event cache
+  void FillEvent(const EventRecord& event, const ProtonRecord* protons);
+  // fills the histograms with the events of the stream in their order and writes them to the event cache
+  void FillStream(const EventStream& stream);
+  // Exec() appends the records to the stream instead of filling histograms, which are then not created.
+  // Has to be set before Init()
+  void SetEventStream(EventStream* stream) { event_stream_ = stream; }
+  void SetEventCache(std::shared_ptr<EventCacheWriter> cache) { event_cache_ = std::move(cache); }
+  // storage of the correlation matrices and the 3D histogram, has to be set before the histograms are initialized
+  void SetHistoStorage(HistoStore::STORAGE storage) { histo_storage_ = storage; }
+  // resampling errors of the mean track values in bins of each multiplicity, 0 replicas disables them.
+  // Has to be set before the histograms are initialized
+  void SetBootstrap(int n_replicas, BootstrapProfile::MODE mode) { n_replicas_ = n_replicas; bootstrap_mode_ = mode; }
+  // axes of the multiplicities and the track values decided from the first events, shared by the tasks of one variant.
+  // Has to be set before the histograms are initialized
+  void SetAutoRange(std::shared_ptr<AutoRange> auto_range) { auto_range_ = std::move(auto_range); }
+  // replaces the ranges of all the axes of the multiplicities and the track values (see GetAxes()) with the ones
+  // of the same names, throws if an axis is missing or unknown. Has to be called before the histograms are initialized
+  void SetAxes(const std::vector<Axis>& axes);
+  std::vector<Axis> GetAxes() const; // the multiplicities followed by the track values, both in the order of enumerators
+  // at the end of the run: the tasks which have not filled their auto-range buffers offer what they have,
+  // then each of them applies the decided ranges to the buffered events
+  void OfferAutoRange() { if( is_range_pending_ ) auto_range_->Offer(sketches_); }
+  void ApplyAutoRange();
+  void PrintMemoryUsage() const; // memory taken by the bin contents of each histogram family
+#ifdef HADES_INSTRUMENTATION
+  void SetStageStats(StageStats* stage_stats) { stage_stats_ = stage_stats; }
+#endif
+private:
+  void InitRangedHistograms(); // histograms with the axes of the multiplicities and the track values
+  void BufferEvent(const EventRecord& event, const ProtonRecord* protons);
+  HistoStore* Make3DHisto( Axis first, Axis second, Axis third ){
+    std::string name = first.name + "_" + second.name+"_"+third.name;
+    std::string title = ";" + first.title + ";"+second.title+ ";"+third.title;
+    return new HistoStore( name, title, {first, second, third}, histo_storage_ );
+  }
+ enum class FIELDS { // enumerator to fast access to detectors' fields
+    HITS_TOF,         // Hits in TOF-system
+    HITS_RPC,         // Hits in RPC-system
+    TRACKS_MDC,
+    FW_SIGNAL,
+    CHI_2,
+    DCA_XY,
+    DCA_Z,
+    WALL_RING,
+    PT3,
+    PT2,
+    GEANT_ID,
+    CENTRALITY,
+    N_FIELDS
   };
-  std::map<FIELDS, int> fields_id_; // map to match detectors' fields with enumerator
+  static constexpr size_t kNFields = static_cast<size_t>(FIELDS::N_FIELDS);
+  std::array<int, kNFields> fields_id_{}; // detectors' fields ids indexed with enumerator
   std::map<MULTIPLICITIES, Axis> multiplicities_axes_{
       std::pair( MULTIPLICITIES::HITS_TOF, Axis{ "hits_tof", "N hits TOF", 100, 0.0, 100.0 } ),
       std::pair( MULTIPLICITIES::HITS_RPC, Axis{ "hits_rpc", "N hits RPC", 200, 0.0, 200.0 } ),
@@ -113,26 +185,41 @@ private:
   /* pointers to link tree's branches with */
   EventHeader* event_header_{nullptr}; 		// event info
   Particles* mdc_vtx_tracks_{nullptr}; 		// tracks
-  HitDetector* meta_hits_{nullptr}; 		// TOF-system
   HitDetector* wall_hits_{nullptr}; 		// FW-system
-  Matching* mdc_meta_matching_{nullptr}; 	// matching between tracking system and TOF-system
-  TH1F* vtx_z_distribution_;
-  TH1F* n_pions_to_all_tracks_;
-  TH2F* vtx_z_multiplicity_distribution_;
-  TH2F* vtx_z_vtx_r_distribution_;
-  TH2F* vtx_x_vtx_y_distribution_;
-  std::map<MULTIPLICITIES,std::map<MULTIPLICITIES,TH2F*>>
-      multiplicities_matrix_;
-  std::map<MULTIPLICITIES,std::map<TRACK_VALUES,TH2F*>>
-      multiplicities_track_values_matrix_;
-  std::map<TRACK_VALUES,std::map<TRACK_VALUES,TH2F*>>
-      track_values_matrix_;
-  TProfile2D* pt_rapidity_chi2_;
-  TProfile2D* pt_rapidity_dca_xy_;
-  TProfile2D* pt_rapidity_dca_z_;
-  TH3F* n_tracks_erat_protons_y_;
-  TFile* file_efficiency_protons_;
-  std::vector<TH2F*> efficiencies_;
+  TrackColumns tracks_; // columnar copy of the current event's tracks
+  WallColumns wall_; // columnar copy of the current event's FW hits
+  std::vector<ProtonRecord> protons_; // protons of the current event
+  std::shared_ptr<EventCacheWriter> event_cache_;
+  EventStream* event_stream_{nullptr}; // the records of Exec() go there if set, owned by the runner
+#ifdef HADES_INSTRUMENTATION
+  StageStats* stage_stats_{nullptr}; // timing of the event loop stages, owned by the runner
+#endif
+  TH1F* vtx_z_distribution_{nullptr};
+  TH1F* n_pions_to_all_tracks_{nullptr};
+  TH2F* vtx_z_multiplicity_distribution_{nullptr};
+  TH2F* vtx_z_vtx_r_distribution_{nullptr};
+  TH2F* vtx_x_vtx_y_distribution_{nullptr};
+  HistoStore::STORAGE histo_storage_{HistoStore::STORAGE::DENSE};
+  // correlation matrices of all pairs of multiplicities and track values: multiplicities x multiplicities,
+  // multiplicities x track values and track values x track values without diagonals. The variables are
+  // the multiplicities followed by the track values, both in the order of enumerators
+  CorrelationMatrices* correlation_matrices_{nullptr};
+  TProfile2D* pt_rapidity_chi2_{nullptr};
+  TProfile2D* pt_rapidity_dca_xy_{nullptr};
+  TProfile2D* pt_rapidity_dca_z_{nullptr};
+  HistoStore* n_tracks_erat_protons_y_{nullptr};
+  int n_replicas_{0};
+  BootstrapProfile::MODE bootstrap_mode_{BootstrapProfile::MODE::POISSON};
+  std::vector<float> bootstrap_weights_; // replica weights of the current event
+  // means of track values vs multiplicities with resampling errors, nullptr without bootstrap
+  std::array<std::array<BootstrapProfile*, kNTrackValues>, kNMultiplicities>
+      bootstrap_profiles_{};
+  std::shared_ptr<const EfficiencyTable> efficiencies_; // may be shared between tasks of different threads
+  std::shared_ptr<AutoRange> auto_range_;
+  bool is_range_pending_{false}; // the events are buffered until the ranges are decided
+  std::vector<QuantileSketch> sketches_; // of the buffered values of the multiplicities and the track values
+  std::vector<EventRecord> buffered_events_;
+  std::vector<ProtonRecord> buffered_protons_;
 };
 } // namespace AnalysisTree
 #endif // QUALITY_ASSURANCE_SRC_TREE_READER_H_
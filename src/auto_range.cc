@@ -0,0 +1,132 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "auto_range.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace AnalysisTree {
+
+namespace {
+constexpr double kLowQuantile = 0.001;
+constexpr double kHighQuantile = 0.999;
+constexpr double kMargin = 0.05; // of the quantile range on each side
+constexpr int kMaxExponentSteps = 20; // powers of 10 tried above the bin width before keeping the default axis
+} // namespace
+
+void AutoRange::Offer(const std::vector<QuantileSketch> &sketches) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if( IsDecided() )
+    return;
+  if( sketches_.empty() ){
+    sketches_ = sketches;
+    return;
+  }
+  if( sketches.size() != sketches_.size() )
+    throw std::runtime_error( "AutoRange: different numbers of variables are offered" );
+  for( size_t i=0; i<sketches.size(); ++i )
+    sketches_[i].Merge(sketches[i]);
+}
+
+std::vector<Axis> AutoRange::Decide(const std::vector<Axis> &default_axes, const std::vector<char> &is_integer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if( IsDecided() )
+    return axes_;
+  axes_ = default_axes;
+  for( size_t i=0; i<axes_.size() && i<sketches_.size(); ++i )
+    axes_[i] = MakeAxis(sketches_[i], default_axes[i], is_integer.at(i));
+  sketches_.clear();
+  is_decided_.store(true, std::memory_order_release);
+  return axes_;
+}
+
+Axis AutoRange::MakeAxis(const QuantileSketch &sketch, const Axis &default_axis, bool is_integer) {
+  auto axis = default_axis;
+  if( sketch.GetCount() == 0 )
+    return axis;
+  auto low = sketch.GetQuantile(kLowQuantile);
+  auto high = sketch.GetQuantile(kHighQuantile);
+  auto margin = kMargin*(high-low);
+  if( !(margin > 0.0) ) // all the values are (almost) the same
+    margin = std::max( kMargin*std::fabs(high), is_integer ? 1.0 : 1e-3 );
+  auto is_non_negative = sketch.GetQuantile(0.0) >= 0.0;
+  low-=margin;
+  high+=margin;
+  if( is_non_negative )
+    low = std::max(low, 0.0);
+  // the smallest round bin width covering [low, high] with the default number of bins
+  static constexpr double kMantissas[] = { 1.0, 2.0, 2.5, 5.0 };
+  auto width = (high-low)/axis.n_bins;
+  if( !(width > 0.0) || !std::isfinite(width) || !std::isfinite(low) ) // e.g. infinite values were sketched
+    return axis;
+  auto first_exponent = static_cast<int>( std::floor(std::log10(width)) );
+  // more than one bin covers the range within a few powers of 10, the bound keeps e.g. a single bin across 0
+  // from searching forever
+  auto last_exponent = std::max(first_exponent, 0) + kMaxExponentSteps;
+  for( auto exponent = first_exponent; exponent <= last_exponent; ++exponent ){
+    for( auto mantissa : kMantissas ){
+      if( is_integer && (mantissa == 2.5 || exponent < 0) )
+        continue;
+      auto step = mantissa*std::pow(10.0, exponent);
+      if( !std::isfinite(step) )
+        return default_axis;
+      auto min = std::floor(low/step)*step;
+      if( min + axis.n_bins*step < high )
+        continue;
+      axis.min = min;
+      axis.max = min + axis.n_bins*step;
+      return axis;
+    }
+  }
+  return default_axis;
+}
+
+std::string AutoRange::GetFileName(const std::string &output_file) {
+  auto file_name = output_file;
+  auto extension = file_name.rfind(".root");
+  if( extension != std::string::npos && extension+5 == file_name.size() )
+    file_name.erase(extension);
+  return file_name + ".ranges";
+}
+
+void AutoRange::Write(const std::string &file_name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ofstream out(file_name);
+  if( !out )
+    throw std::runtime_error( "AutoRange: cannot write " + file_name );
+  out.precision(std::numeric_limits<double>::max_digits10);
+  for( const auto& axis : axes_ )
+    out << axis.name << "=" << axis.min << ":" << axis.max << ":" << axis.n_bins << "\n";
+}
+
+std::vector<Axis> AutoRange::ReadAxes(const std::string &file_name) {
+  std::ifstream in(file_name);
+  if( !in )
+    throw std::runtime_error( "AutoRange: cannot open " + file_name );
+  std::vector<Axis> axes;
+  std::string line;
+  int line_number{0};
+  while( std::getline(in, line) ){
+    line_number++;
+    if( line.empty() || line[0] == '#' )
+      continue;
+    auto equal_sign = line.find('=');
+    Axis axis{ line.substr(0, equal_sign), "", 0, 0.0, 0.0 };
+    char colon_1{0};
+    char colon_2{0};
+    std::istringstream range( equal_sign == std::string::npos ? std::string{} : line.substr(equal_sign+1) );
+    range >> axis.min >> colon_1 >> axis.max >> colon_2 >> axis.n_bins;
+    if( equal_sign == std::string::npos || !range || colon_1 != ':' || colon_2 != ':' || axis.n_bins < 1 || !(axis.min < axis.max) )
+      throw std::runtime_error( file_name + ":" + std::to_string(line_number) + ": expected name=min:max:n_bins" );
+    axes.push_back(axis);
+  }
+  return axes;
+}
+
+} // namespace AnalysisTree
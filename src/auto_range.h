@@ -0,0 +1,52 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_AUTO_RANGE_H_
+#define HADES_CONTAMINATIONS_SRC_AUTO_RANGE_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "histo_store.h"
+#include "quantile_sketch.h"
+
+namespace AnalysisTree {
+
+/* Axis ranges decided from the data, shared by the tasks of one variant so their histograms can be merged.
+ * The tasks buffer their first events and sketch the distributions of the variables. The first task with a full
+ * buffer offers its sketches and decides the ranges for all of them. The tasks which have not filled their buffers
+ * by the end of the run offer theirs first, so a short run decides on all its events.
+ * TaskRunner fills one task per variant in the order of entries, so the ranges are decided on the first
+ * buffer size events of the input, whatever the number of threads.
+ * A range covers the quantiles 0.001-0.999 of the sketch with a margin of 5% on each side, keeps the number
+ * of bins of the default axis and is rounded to bin widths of 1, 2, 2.5 or 5 times a power of 10
+ * (1, 2 or 5 for integer variables), so similar samples give the same axes. A variable whose range is not finite,
+ * or cannot be rounded this way, keeps the default axis. */
+class AutoRange {
+public:
+  explicit AutoRange(size_t buffer_size) : buffer_size_(buffer_size) {}
+  size_t GetBufferSize() const { return buffer_size_; } // events buffered by a task before it decides
+  bool IsDecided() const { return is_decided_.load(std::memory_order_acquire); }
+  // adds the sketches of a task to the ones the ranges are decided from, ignored once they are decided
+  void Offer(const std::vector<QuantileSketch>& sketches);
+  // axes of the variables decided at the first call, the same for every later call
+  std::vector<Axis> Decide(const std::vector<Axis>& default_axes, const std::vector<char>& is_integer);
+  static Axis MakeAxis(const QuantileSketch& sketch, const Axis& default_axis, bool is_integer);
+  static std::string GetFileName(const std::string& output_file); // output.root -> output.ranges
+  // writes the decided axes as name=min:max:n_bins lines, to be read with ReadAxes
+  void Write(const std::string& file_name) const;
+  static std::vector<Axis> ReadAxes(const std::string& file_name);
+
+private:
+  mutable std::mutex mutex_;
+  size_t buffer_size_;
+  std::vector<QuantileSketch> sketches_;
+  std::vector<Axis> axes_;
+  std::atomic<bool> is_decided_{false};
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_AUTO_RANGE_H_
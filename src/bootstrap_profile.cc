@@ -0,0 +1,206 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "bootstrap_profile.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include <TDirectory.h>
+#include <TParameter.h>
+
+namespace AnalysisTree {
+
+namespace {
+uint64_t SplitMix64(uint64_t x){
+  x+=0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+// Poisson(1) variate from a uniform number in [0, 1) by inversion of the cumulative distribution
+float Poisson1(double u){
+  int k{0};
+  double p = std::exp(-1.0);
+  double cumulative = p;
+  while( u >= cumulative && k < 20 ){
+    k++;
+    p/=k;
+    cumulative+=p;
+  }
+  return static_cast<float>(k);
+}
+} // namespace
+
+BootstrapProfile::BootstrapProfile(std::string name, std::string title, Axis axis, int n_replicas, MODE mode) :
+    name_(std::move(name)), title_(std::move(title)), axis_(std::move(axis)), n_replicas_(n_replicas), mode_(mode),
+    n_columns_(static_cast<size_t>(n_replicas)+1) {
+  if( n_replicas_ < 2 )
+    throw std::runtime_error( "BootstrapProfile " + name_ + ": at least 2 replicas are needed" );
+  sum_w_.assign( static_cast<size_t>(axis_.n_bins+2)*n_columns_, 0.0 );
+  sum_wy_.assign( sum_w_.size(), 0.0 );
+}
+
+BootstrapProfile::MODE BootstrapProfile::ParseMode(const std::string &mode) {
+  if( mode == "poisson" )
+    return MODE::POISSON;
+  if( mode == "subsample" )
+    return MODE::SUBSAMPLE;
+  throw std::runtime_error( R"(Unknown bootstrap mode ")" + mode + R"(". Only "poisson" or "subsample" are expected)" );
+}
+
+const char *BootstrapProfile::GetModeName(MODE mode) {
+  return mode == MODE::POISSON ? "poisson" : "subsample";
+}
+
+void BootstrapProfile::WriteModeTag(MODE mode) {
+  TParameter<int> tag(kModeTagName, static_cast<int>(mode), 'f');
+  tag.Write();
+}
+
+BootstrapProfile::MODE BootstrapProfile::GetMode(const TObject *tag) {
+  auto mode_tag = dynamic_cast<const TParameter<int>*>(tag);
+  if( !mode_tag )
+    throw std::runtime_error( std::string("BootstrapProfile: ") + kModeTagName + " is not a TParameter<int>" );
+  switch( mode_tag->GetVal() ){
+  case static_cast<int>(MODE::POISSON): return MODE::POISSON;
+  case static_cast<int>(MODE::SUBSAMPLE): return MODE::SUBSAMPLE;
+  default: throw std::runtime_error( std::string("BootstrapProfile: unknown mode ") + std::to_string(mode_tag->GetVal()) +
+                                     " in " + kModeTagName );
+  }
+}
+
+BootstrapProfile::MODE BootstrapProfile::ReadModeTag(TDirectory *directory) {
+  TObject* tag{nullptr};
+  directory->GetObject(kModeTagName, tag);
+  std::unique_ptr<TObject> owned_tag(tag);
+  if( !tag )
+    throw std::runtime_error( std::string("BootstrapProfile: no ") + kModeTagName + " in " + directory->GetName() );
+  return GetMode(tag);
+}
+
+uint64_t BootstrapProfile::GetEventKey(const void *data, size_t size) {
+  // FNV-1a
+  auto bytes = static_cast<const unsigned char*>(data);
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for( size_t i=0; i<size; ++i ){
+    hash^=bytes[i];
+    hash*=0x100000001b3ull;
+  }
+  return hash;
+}
+
+void BootstrapProfile::GetWeights(uint64_t event_key, MODE mode, int n_replicas, float *weights) {
+  if( mode == MODE::SUBSAMPLE ){
+    std::fill( weights, weights+n_replicas, 0.0f );
+    weights[ SplitMix64(event_key) % static_cast<uint64_t>(n_replicas) ] = 1.0f;
+    return;
+  }
+  for( int r=0; r<n_replicas; ++r ){
+    auto bits = SplitMix64( event_key + static_cast<uint64_t>(r+1)*0xd1b54a32d192ed03ull );
+    weights[r] = Poisson1( static_cast<double>(bits >> 11) * 0x1.0p-53 );
+  }
+}
+
+void BootstrapProfile::Add(const BootstrapProfile *other) {
+  if( other->sum_w_.size() != sum_w_.size() || other->mode_ != mode_ )
+    throw std::runtime_error( "BootstrapProfile " + name_ + ": cannot add profile with different binning or replicas" );
+  for( size_t i=0; i<sum_w_.size(); ++i ){
+    sum_w_[i]+=other->sum_w_[i];
+    sum_wy_[i]+=other->sum_wy_[i];
+  }
+}
+
+void BootstrapProfile::AddHistos(const TH1 *sum_w, const TH1 *sum_wy) {
+  auto n_cells = static_cast<size_t>(axis_.n_bins+2);
+  if( !axis_.HasBinning(sum_w->GetXaxis()) || sum_w->GetNbinsY() != static_cast<int>(n_columns_) ||
+      !axis_.HasBinning(sum_wy->GetXaxis()) || sum_wy->GetNbinsY() != static_cast<int>(n_columns_) )
+    throw std::runtime_error( "BootstrapProfile " + name_ + ": cannot add histograms with different binning or replicas" );
+  for( size_t x=0; x<n_cells; ++x )
+    for( size_t column=0; column<n_columns_; ++column ){
+      auto x_bin = static_cast<int>(x);
+      auto column_bin = static_cast<int>(column)+1;
+      sum_w_[x*n_columns_+column]+=sum_w->GetBinContent(x_bin, column_bin);
+      sum_wy_[x*n_columns_+column]+=sum_wy->GetBinContent(x_bin, column_bin);
+    }
+}
+
+TH2D *BootstrapProfile::MakeSumHisto(const std::string &name, const std::string &title, const std::vector<double> &sums) const {
+  auto histo = new TH2D( name.c_str(), title.c_str(), axis_.n_bins, axis_.min, axis_.max,
+                         static_cast<int>(n_columns_), -0.5, static_cast<double>(n_columns_)-0.5 );
+  histo->SetDirectory(nullptr);
+  auto n_cells = static_cast<size_t>(axis_.n_bins+2);
+  double entries{0.0}; // events filled into the whole sample
+  for( size_t x=0; x<n_cells; ++x ){
+    entries+=sum_w_[x*n_columns_];
+    for( size_t column=0; column<n_columns_; ++column )
+      if( sums[x*n_columns_+column] != 0.0 )
+        histo->SetBinContent( static_cast<int>(x), static_cast<int>(column)+1, sums[x*n_columns_+column] );
+  }
+  histo->SetEntries(entries);
+  return histo;
+}
+
+void BootstrapProfile::Write() const {
+  // title_ is ";x title;y title", the title of y goes to the z axis of the weighted sums for MakeEstimate
+  auto y_title_position = title_.find(';', 1);
+  auto x_title = title_.substr(0, y_title_position);
+  auto y_title = y_title_position == std::string::npos ? std::string{} : title_.substr(y_title_position+1);
+  auto sum_w = MakeSumHisto(GetSumWName(), x_title + ";replica", sum_w_);
+  auto sum_wy = MakeSumHisto(GetSumWYName(), x_title + ";replica;" + y_title, sum_wy_);
+  auto estimate = MakeEstimate(sum_w, sum_wy, mode_);
+  sum_w->Write();
+  sum_wy->Write();
+  estimate->Write();
+  delete sum_w;
+  delete sum_wy;
+  delete estimate;
+}
+
+TH1D *BootstrapProfile::MakeEstimate(const TH1 *sum_w, const TH1 *sum_wy, MODE mode) {
+  std::string name = sum_w->GetName();
+  auto suffix = name.rfind(kSumWSuffix);
+  if( suffix == std::string::npos )
+    throw std::runtime_error( "BootstrapProfile: " + name + " is not a sum of replica weights" );
+  name = name.substr(0, suffix) + kEstimateSuffix;
+  const auto x_axis = sum_w->GetXaxis();
+  auto n_replicas = sum_w->GetNbinsY()-1;
+  auto title = ";" + std::string(x_axis->GetTitle()) + ";" + sum_wy->GetZaxis()->GetTitle();
+  auto estimate = new TH1D( name.c_str(), title.c_str(), x_axis->GetNbins(), x_axis->GetXmin(), x_axis->GetXmax() );
+  estimate->SetDirectory(nullptr);
+  double entries{0.0};
+  for( int x=0; x<x_axis->GetNbins()+2; ++x ){
+    auto whole_w = sum_w->GetBinContent(x, 1);
+    if( whole_w <= 0.0 )
+      continue;
+    entries+=whole_w;
+    // spread of the means of the replicas with non-zero weight
+    int n{0};
+    double sum{0.0};
+    double sum2{0.0};
+    for( int r=1; r<=n_replicas; ++r ){
+      auto w = sum_w->GetBinContent(x, r+1);
+      if( w <= 0.0 )
+        continue;
+      auto mean = sum_wy->GetBinContent(x, r+1) / w;
+      n++;
+      sum+=mean;
+      sum2+=mean*mean;
+    }
+    double error{0.0};
+    if( n > 1 ){
+      auto variance = std::max( 0.0, (sum2 - sum*sum/n) / (n-1) );
+      if( mode == MODE::SUBSAMPLE )
+        variance/=n;
+      error = std::sqrt(variance);
+    }
+    estimate->SetBinContent( x, sum_wy->GetBinContent(x, 1) / whole_w );
+    estimate->SetBinError( x, error );
+  }
+  estimate->SetEntries(entries);
+  return estimate;
+}
+
+} // namespace AnalysisTree
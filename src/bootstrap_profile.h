@@ -0,0 +1,90 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_BOOTSTRAP_PROFILE_H_
+#define HADES_CONTAMINATIONS_SRC_BOOTSTRAP_PROFILE_H_
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <TH1D.h>
+#include <TH2D.h>
+
+#include "histo_store.h"
+
+namespace AnalysisTree {
+
+/* Mean of an event-level observable y in bins of x with statistical errors estimated in the same pass
+ * by resampling. Every event gets a weight for each of N replicas, a deterministic function of the event
+ * (see GetEventKey), so reruns, threads, checkpoints and the event cache replay give the same replicas:
+ *  POISSON   - independent Poisson(1) weights, the bootstrap error is the spread of the replica means,
+ *  SUBSAMPLE - the event goes to one of N subsamples with weight 1, the error is the spread of the
+ *              subsample means divided by sqrt(N).
+ * Per cell of x only the sums of weights and of weighted y are kept for the whole sample and each replica,
+ * (n_bins+2)*(N+1)*2 doubles, instead of N copies of the correlation matrix.
+ * Write() stores the sums as two TH2D (x vs replica, replica 0 is the whole sample) which stay additive
+ * across threads, checkpoints and jobs, and the estimate derived from them as a TH1D with the mean
+ * of the whole sample as bin content and the resampling error as bin error. The mode is not stored with
+ * the profiles: the output has one TParameter<int> tag for all of them (see WriteModeTag). */
+class BootstrapProfile {
+public:
+  enum class MODE { POISSON = 0, SUBSAMPLE = 1 }; // the values are stored in the mode tag
+  BootstrapProfile(std::string name, std::string title, Axis axis, int n_replicas, MODE mode);
+  static MODE ParseMode(const std::string& mode); // "poisson" or "subsample"
+  static const char* GetModeName(MODE mode);
+  // writes the mode to the current directory as a tag which has to be equal in the outputs being merged
+  static void WriteModeTag(MODE mode);
+  static MODE GetMode(const TObject* tag); // throws if the object is not a mode tag
+  static MODE ReadModeTag(TDirectory* directory);
+  // 64 bit hash of the bytes of an event record
+  static uint64_t GetEventKey(const void* data, size_t size);
+  // fills n_replicas weights of the event with the given key
+  static void GetWeights(uint64_t event_key, MODE mode, int n_replicas, float* weights);
+
+  void Fill(double x, double y, const float* weights) {
+    if( !std::isfinite(y) )
+      return;
+    auto row = static_cast<size_t>( axis_.FindBin(x) ) * n_columns_;
+    auto sum_w = sum_w_.data() + row;
+    auto sum_wy = sum_wy_.data() + row;
+    sum_w[0]+=1.0;
+    sum_wy[0]+=y;
+    for( int r=0; r<n_replicas_; ++r ){
+      sum_w[r+1]+=weights[r];
+      sum_wy[r+1]+=weights[r]*y;
+    }
+  }
+  void Add(const BootstrapProfile* other);
+  void AddHistos(const TH1* sum_w, const TH1* sum_wy); // adds the sums written with Write() and read back
+  void Write() const; // writes the sums and the estimate to the current directory
+  // estimate from the sums written by Write(), used when the outputs of several jobs are merged
+  static TH1D* MakeEstimate(const TH1* sum_w, const TH1* sum_wy, MODE mode);
+  size_t GetMemoryUsage() const { return (sum_w_.capacity()+sum_wy_.capacity())*sizeof(double); }
+  const std::string& GetName() const { return name_; }
+  std::string GetSumWName() const { return name_ + kSumWSuffix; }
+  std::string GetSumWYName() const { return name_ + kSumWYSuffix; }
+  std::string GetEstimateName() const { return name_ + kEstimateSuffix; }
+
+  static constexpr const char* kSumWSuffix = "_replicas_sum_w";
+  static constexpr const char* kSumWYSuffix = "_replicas_sum_wy";
+  static constexpr const char* kEstimateSuffix = "_bootstrap";
+  static constexpr const char* kModeTagName = "bootstrap_mode";
+
+private:
+  TH2D* MakeSumHisto(const std::string& name, const std::string& title, const std::vector<double>& sums) const;
+
+  std::string name_;
+  std::string title_; // ";x title;y title"
+  Axis axis_;
+  int n_replicas_;
+  MODE mode_;
+  size_t n_columns_; // the whole sample and the replicas
+  std::vector<double> sum_w_; // [x cell][column]
+  std::vector<double> sum_wy_;
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_BOOTSTRAP_PROFILE_H_
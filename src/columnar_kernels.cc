@@ -0,0 +1,81 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "columnar_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace AnalysisTree {
+
+void TrackColumns::Load(const Particles &tracks, int geant_pid_field_id) {
+  size = tracks.GetNumberOfChannels();
+  if( px.size() < size ){
+    for( auto column : {&px, &py, &pz, &mass, &pt, &p, &energy, &rapidity, &theta, &cos_theta, &sin_theta} )
+      column->resize(size);
+    pid.resize(size);
+    geant_pid.resize(size);
+  }
+  for( size_t i=0; i<size; ++i ){
+    const auto& track = tracks.GetChannel(i);
+    px[i] = track.GetPx();
+    py[i] = track.GetPy();
+    pz[i] = track.GetPz();
+    mass[i] = track.GetMass();
+    pid[i] = track.GetPid();
+    geant_pid[i] = track.GetField<int>(geant_pid_field_id);
+  }
+}
+
+void TrackColumns::Compute() {
+  const auto n = size;
+  const double* __restrict x = px.data();
+  const double* __restrict y = py.data();
+  const double* __restrict z = pz.data();
+  const double* __restrict m = mass.data();
+  double* __restrict pt_out = pt.data();
+  double* __restrict p_out = p.data();
+  double* __restrict e_out = energy.data();
+  // branch-free element-wise passes, vectorized by the compiler
+  for( size_t i=0; i<n; ++i )
+    pt_out[i] = std::sqrt( x[i]*x[i] + y[i]*y[i] );
+  for( size_t i=0; i<n; ++i )
+    p_out[i] = std::sqrt( x[i]*x[i] + y[i]*y[i] + z[i]*z[i] );
+  for( size_t i=0; i<n; ++i ){
+    auto p2 = x[i]*x[i] + y[i]*y[i] + z[i]*z[i];
+    e_out[i] = m[i] >= 0 ? std::sqrt( p2 + m[i]*m[i] ) : std::sqrt( std::max( p2 - m[i]*m[i], 0.0 ) );
+  }
+  // transcendental passes
+  for( size_t i=0; i<n; ++i )
+    rapidity[i] = 0.5*std::log( (e_out[i]+z[i]) / (e_out[i]-z[i]) );
+  for( size_t i=0; i<n; ++i )
+    theta[i] = x[i] == 0.0 && y[i] == 0.0 && z[i] == 0.0 ? 0.0 : std::atan2( pt_out[i], z[i] );
+  for( size_t i=0; i<n; ++i ){
+    cos_theta[i] = std::cos(theta[i]);
+    sin_theta[i] = std::sin(theta[i]);
+  }
+}
+
+void WallColumns::Load(const HitDetector &hits, int ring_field_id) {
+  size = hits.GetNumberOfChannels();
+  if( signal.size() < size ){
+    signal.resize(size);
+    group.resize(size);
+  }
+  for( size_t i=0; i<size; ++i ){
+    const auto& hit = hits.GetChannel(i);
+    signal[i] = hit.GetSignal();
+    group[i] = GetGroup( hit.GetField<int>(ring_field_id) );
+  }
+}
+
+std::array<float, WallColumns::N_GROUPS> WallColumns::SumSignals() const {
+  // the reduction keeps the order of the hits, so float sums are the same as in the per-hit loop
+  std::array<float, N_GROUPS> sums{};
+  for( size_t i=0; i<size; ++i )
+    sums[group[i]] += signal[i];
+  return sums;
+}
+
+} // namespace AnalysisTree
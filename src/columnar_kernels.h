@@ -0,0 +1,82 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_COLUMNAR_KERNELS_H_
+#define HADES_CONTAMINATIONS_SRC_COLUMNAR_KERNELS_H_
+
+#include <array>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <AnalysisTree/Detector.hpp>
+
+namespace AnalysisTree {
+
+// allocator giving cache-line aligned storage, so the column loops can use aligned vector loads
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator{
+  using value_type = T;
+  template<typename U> struct rebind{ using other = AlignedAllocator<U, Alignment>; };
+  AlignedAllocator() = default;
+  template<typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+  T* allocate(size_t n){
+    auto size = ( n*sizeof(T) + Alignment-1 ) / Alignment * Alignment;
+    if( auto ptr = std::aligned_alloc(Alignment, size) )
+      return static_cast<T*>(ptr);
+    throw std::bad_alloc();
+  }
+  void deallocate(T* ptr, size_t) { std::free(ptr); }
+  template<typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+  template<typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+template<typename T>
+using Column = std::vector<T, AlignedAllocator<T>>;
+
+/* Kinematics of all tracks of an event in a columnar layout.
+ * Load() gathers the momenta, masses and pids, Compute() evaluates the per-track quantities column by column.
+ * The formulas and the order of floating point operations are the ones of TLorentzVector::SetXYZM, Pt(), P(),
+ * Energy(), Rapidity() and Theta(), so the results are identical to the TLorentzVector based loop.
+ * Columns only grow: after the largest event has been seen nothing is allocated. */
+struct TrackColumns{
+  void Load(const Particles& tracks, int geant_pid_field_id);
+  void Compute();
+  size_t size{0};
+  // input columns
+  Column<double> px;
+  Column<double> py;
+  Column<double> pz;
+  Column<double> mass;
+  Column<int> pid;
+  Column<int> geant_pid;
+  // computed columns
+  Column<double> pt;
+  Column<double> p;
+  Column<double> energy;
+  Column<double> rapidity;
+  Column<double> theta;
+  Column<double> cos_theta;
+  Column<double> sin_theta;
+};
+
+/* Forward wall signals summed over the groups of rings W1 (rings <= 5), W2 (6-7) and W3 (8-10).
+ * The ring numbers are mapped to the groups with a lookup table; module ids are not used as a key,
+ * since AnalysisTree assigns channel ids per event in the order of the hits. */
+struct WallColumns{
+  enum GROUPS { W1, W2, W3, NONE, N_GROUPS };
+  void Load(const HitDetector& hits, int ring_field_id);
+  std::array<float, N_GROUPS> SumSignals() const;
+  static int GetGroup(int ring){
+    static constexpr std::array<int, 12> groups{ W1, W1, W1, W1, W1, W1, W2, W2, W3, W3, W3, NONE };
+    if( ring < 0 )
+      return W1;
+    return groups[ ring < 11 ? ring : 11 ];
+  }
+  size_t size{0};
+  Column<float> signal;
+  Column<int> group;
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_COLUMNAR_KERNELS_H_
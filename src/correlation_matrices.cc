@@ -0,0 +1,158 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "correlation_matrices.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace AnalysisTree {
+
+CorrelationMatrices::CorrelationMatrices(std::vector<Axis> variables, std::vector<Pair> pairs, HistoStore::STORAGE storage) :
+    variables_(std::move(variables)), storage_(storage), stats_(pairs.size()), bins_(variables_.size()) {
+  for( const auto& pair : pairs ){
+    if( pair.x >= variables_.size() || pair.y >= variables_.size() )
+      throw std::runtime_error( "CorrelationMatrices: variable index is out of range" );
+    auto stride = static_cast<size_t>(variables_[pair.x].n_bins+2);
+    auto n_cells = stride * static_cast<size_t>(variables_[pair.y].n_bins+2);
+    if( n_cells_ + n_cells > static_cast<size_t>(std::numeric_limits<int32_t>::max()) )
+      throw std::runtime_error( "CorrelationMatrices: too many cells for 32 bit indices" );
+    pairs_.push_back( { pair.x, pair.y, static_cast<int32_t>(n_cells_), static_cast<int32_t>(stride), static_cast<int32_t>(n_cells) } );
+    n_cells_+=n_cells;
+  }
+}
+
+void CorrelationMatrices::Fill(const double *values) {
+  entries_++;
+  for( size_t v=0; v<variables_.size(); ++v )
+    bins_[v] = variables_[v].FindBin(values[v]);
+  if( storage_ == HistoStore::STORAGE::DENSE && dense_bins_.empty() )
+    dense_bins_.assign(n_cells_, 0.0f);
+  for( size_t p=0; p<pairs_.size(); ++p ){
+    const auto& pair = pairs_[p];
+    auto bin_x = bins_[pair.x];
+    auto bin_y = bins_[pair.y];
+    auto cell = pair.offset + bin_x + pair.stride*bin_y;
+    if( storage_ == HistoStore::STORAGE::DENSE )
+      dense_bins_[cell]+=1.0f;
+    else
+      sparse_bins_.Add(cell, 1.0f);
+    if( bin_x == 0 || bin_x > variables_[pair.x].n_bins )
+      continue;
+    if( bin_y == 0 || bin_y > variables_[pair.y].n_bins )
+      continue;
+    auto x = values[pair.x];
+    auto y = values[pair.y];
+    auto& stats = stats_[p];
+    stats[0]+=1; stats[1]+=1;
+    stats[2]+=x; stats[3]+=x*x;
+    stats[4]+=y; stats[5]+=y*y;
+    stats[6]+=x*y;
+  }
+}
+
+void CorrelationMatrices::AddBinContent(int32_t cell, float value) {
+  if( storage_ == HistoStore::STORAGE::SPARSE ){
+    sparse_bins_.Add(cell, value);
+    return;
+  }
+  if( dense_bins_.empty() )
+    dense_bins_.assign(n_cells_, 0.0f);
+  dense_bins_[cell]+=value;
+}
+
+void CorrelationMatrices::Add(const CorrelationMatrices *other) {
+  if( other->n_cells_ != n_cells_ || other->pairs_.size() != pairs_.size() )
+    throw std::runtime_error( "CorrelationMatrices: cannot add matrices with different binning" );
+  if( other->storage_ == HistoStore::STORAGE::SPARSE )
+    other->sparse_bins_.ForEach( [this](int32_t cell, float value){ AddBinContent(cell, value); } );
+  else
+    for( size_t cell=0; cell<other->dense_bins_.size(); ++cell )
+      if( other->dense_bins_[cell] != 0.0f )
+        AddBinContent(cell, other->dense_bins_[cell]);
+  entries_+=other->entries_;
+  for( size_t p=0; p<stats_.size(); ++p )
+    for( size_t i=0; i<kNStats; ++i )
+      stats_[p][i]+=other->stats_[p][i];
+}
+
+void CorrelationMatrices::AddHisto(size_t pair, const TH1 *histo) {
+  const auto& layout = pairs_.at(pair);
+  if( histo->GetNcells() != layout.n_cells || histo->GetDimension() != 2 ||
+      !variables_[layout.x].HasBinning(histo->GetXaxis()) || !variables_[layout.y].HasBinning(histo->GetYaxis()) )
+    throw std::runtime_error( "CorrelationMatrices: cannot add " + GetName(pair) + " with different binning" );
+  for( int bin=0; bin<histo->GetNcells(); ++bin ){
+    auto content = static_cast<float>( histo->GetBinContent(bin) );
+    if( content != 0.0f )
+      AddBinContent(layout.offset+bin, content);
+  }
+  // the entries are common to all pairs, each pair of a restored file carries the same number
+  if( pair == 0 )
+    entries_+=histo->GetEntries();
+  std::array<double, 11> stats{};
+  histo->GetStats(stats.data());
+  for( size_t i=0; i<kNStats; ++i )
+    stats_[pair][i]+=stats[i];
+}
+
+std::string CorrelationMatrices::GetName(size_t pair) const {
+  const auto& layout = pairs_.at(pair);
+  return variables_[layout.x].name + "_" + variables_[layout.y].name;
+}
+
+std::vector<std::unique_ptr<TH1>> CorrelationMatrices::ToHistos() const {
+  std::vector<std::unique_ptr<TH1>> histos;
+  for( size_t p=0; p<pairs_.size(); ++p ){
+    const auto& x = variables_[pairs_[p].x];
+    const auto& y = variables_[pairs_[p].y];
+    auto title = ";" + x.title + ";" + y.title;
+    histos.emplace_back( new TH2F( GetName(p).c_str(), title.c_str(), x.n_bins, x.min, x.max, y.n_bins, y.min, y.max ) );
+    histos.back()->SetDirectory(nullptr);
+  }
+  // one pass over the cells, the pair of a cell is found by its offset
+  auto set_cell = [this, &histos](int32_t cell, float value){
+    auto layout = std::upper_bound( pairs_.begin(), pairs_.end(), cell,
+                                    [](int32_t c, const Layout& l){ return c < l.offset; } ) - 1;
+    histos[layout-pairs_.begin()]->SetBinContent(cell-layout->offset, value);
+  };
+  if( storage_ == HistoStore::STORAGE::SPARSE )
+    sparse_bins_.ForEach(set_cell);
+  else
+    for( size_t cell=0; cell<dense_bins_.size(); ++cell )
+      if( dense_bins_[cell] != 0.0f )
+        set_cell(static_cast<int32_t>(cell), dense_bins_[cell]);
+  // SetBinContent resets the statistics, they are restored afterwards
+  for( size_t p=0; p<pairs_.size(); ++p ){
+    std::array<double, 11> stats{};
+    std::copy( stats_[p].begin(), stats_[p].end(), stats.begin() );
+    histos[p]->PutStats(stats.data());
+    histos[p]->SetEntries(entries_);
+  }
+  return histos;
+}
+
+size_t CorrelationMatrices::GetMemoryUsage() const {
+  if( storage_ == HistoStore::STORAGE::SPARSE )
+    return sparse_bins_.GetMemoryUsage();
+  return dense_bins_.capacity()*sizeof(float);
+}
+
+size_t CorrelationMatrices::GetMemoryUsage(size_t first_pair, size_t last_pair) const {
+  if( first_pair >= last_pair || last_pair > pairs_.size() )
+    return 0;
+  auto first_cell = pairs_[first_pair].offset;
+  auto last_cell = pairs_[last_pair-1].offset + pairs_[last_pair-1].n_cells;
+  if( storage_ == HistoStore::STORAGE::DENSE )
+    return dense_bins_.empty() ? 0 : static_cast<size_t>(last_cell-first_cell)*sizeof(float);
+  size_t n_filled{0};
+  size_t n_in_range{0};
+  sparse_bins_.ForEach( [&n_filled, &n_in_range, first_cell, last_cell](int32_t cell, float){
+    n_filled++;
+    n_in_range+= cell >= first_cell && cell < last_cell;
+  } );
+  return n_filled == 0 ? 0 : sparse_bins_.GetMemoryUsage()*n_in_range/n_filled;
+}
+
+} // namespace AnalysisTree
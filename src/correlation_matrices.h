@@ -0,0 +1,66 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_CORRELATION_MATRICES_H_
+#define HADES_CONTAMINATIONS_SRC_CORRELATION_MATRICES_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "histo_store.h"
+
+namespace AnalysisTree {
+
+/* 2D histograms of many pairs of the same event variables, filled together once per event.
+ * The bin of each variable is found once per event instead of once per pair and histogram, and the
+ * bin contents of all pairs are one block of cells (dense array or hash, as in HistoStore), so
+ * a fill is an add at offset + bin_x + (n_x+2)*bin_y per pair.
+ * ToHistos() gives the same TH2F as HistoStore filled with the same values: float bin contents,
+ * entries counted for every fill and statistics of the in-range fills. */
+class CorrelationMatrices {
+public:
+  struct Pair{
+    size_t x; // indices of the variables
+    size_t y;
+  };
+  CorrelationMatrices(std::vector<Axis> variables, std::vector<Pair> pairs, HistoStore::STORAGE storage);
+  void Fill(const double* values); // values of all the variables in one event
+  void Add(const CorrelationMatrices* other);
+  void AddHisto(size_t pair, const TH1* histo); // adds TH2F of the pair, e.g. converted with ToHistos() and read back
+  std::vector<std::unique_ptr<TH1>> ToHistos() const; // TH2F of the pairs in their order, detached from any directory
+  size_t GetNPairs() const { return pairs_.size(); }
+  std::string GetName(size_t pair) const;
+  size_t GetMemoryUsage() const; // bytes taken by bin contents
+  // bytes taken by bin contents of the pairs [first_pair, last_pair). The sparse storage is shared by all the pairs
+  // and is attributed in proportion to the filled cells
+  size_t GetMemoryUsage(size_t first_pair, size_t last_pair) const;
+  HistoStore::STORAGE GetStorage() const { return storage_; }
+
+private:
+  static constexpr size_t kNStats = 7; // sumw, sumw2, sumwx, sumwx2, sumwy, sumwy2, sumwxy as in TH2::GetStats
+  struct Layout{
+    size_t x;
+    size_t y;
+    int32_t offset; // first cell of the pair in the block
+    int32_t stride; // cells in a row of x, n_bins+2
+    int32_t n_cells;
+  };
+  void AddBinContent(int32_t cell, float value);
+
+  std::vector<Axis> variables_;
+  std::vector<Layout> pairs_;
+  HistoStore::STORAGE storage_;
+  size_t n_cells_{0};
+  std::vector<float> dense_bins_; // allocated with the first fill
+  HistoStore::SparseBins sparse_bins_;
+  double entries_{0.0}; // every pair is filled with every event
+  std::vector<std::array<double, kNStats>> stats_; // per pair
+  std::vector<int32_t> bins_; // bins of the variables in the current event
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_CORRELATION_MATRICES_H_
@@ -0,0 +1,128 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "efficiency_table.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#include <TFile.h>
+
+namespace AnalysisTree {
+
+namespace {
+constexpr char kMagic[8] = {'H','E','F','F','T','A','B','1'};
+
+template<typename T>
+void WriteValue(std::ofstream& out, const T& value){
+  out.write( reinterpret_cast<const char*>(&value), sizeof(T) );
+}
+template<typename T>
+void ReadValue(std::ifstream& in, T& value){
+  in.read( reinterpret_cast<char*>(&value), sizeof(T) );
+}
+} // namespace
+
+void EfficiencyTable::Load(const std::string &file_name) {
+  std::ifstream in(file_name, std::ios::binary);
+  if( !in )
+    throw std::runtime_error( "Efficiency file not found" );
+  char magic[sizeof(kMagic)]{};
+  in.read(magic, sizeof(magic));
+  in.close();
+  if( std::memcmp(magic, kMagic, sizeof(kMagic)) == 0 )
+    ReadBinaryFile(file_name);
+  else
+    ReadRootFile(file_name);
+  BuildWeights();
+}
+
+void EfficiencyTable::ReadRootFile(const std::string &file_name) {
+  std::unique_ptr<TFile> file( TFile::Open(file_name.c_str(), "read") );
+  if( !file )
+    throw std::runtime_error( "Efficiency file not found" );
+  std::vector<std::unique_ptr<TH2F>> matrices;
+  int p=2;
+  while(p<60){
+    TH2F* matrix{nullptr};
+    std::string name = "efficiency_"+std::to_string(p);
+    file->GetObject(name.c_str(), matrix);
+    if( !matrix )
+      throw std::runtime_error( "Efficiency matrix " +name+ " not found" );
+    matrix->SetDirectory(nullptr); // owned here, not by the file
+    matrices.emplace_back(matrix);
+    p+=5;
+  }
+  auto x_axis = matrices.front()->GetXaxis();
+  auto y_axis = matrices.front()->GetYaxis();
+  x_axis_ = Binning{ x_axis->GetNbins(), x_axis->GetXmin(), x_axis->GetXmax() };
+  y_axis_ = Binning{ y_axis->GetNbins(), y_axis->GetXmin(), y_axis->GetXmax() };
+  for( const auto& matrix : matrices ){
+    if( matrix->GetXaxis()->IsVariableBinSize() || matrix->GetYaxis()->IsVariableBinSize() )
+      throw std::runtime_error( std::string("Efficiency matrix ") + matrix->GetName() + " has variable bin size" );
+    if( matrix->GetNbinsX() != x_axis_.n_bins || matrix->GetXaxis()->GetXmin() != x_axis_.min || matrix->GetXaxis()->GetXmax() != x_axis_.max ||
+        matrix->GetNbinsY() != y_axis_.n_bins || matrix->GetYaxis()->GetXmin() != y_axis_.min || matrix->GetYaxis()->GetXmax() != y_axis_.max )
+      throw std::runtime_error( std::string("Efficiency matrix ") + matrix->GetName() + " has binning different from the others" );
+  }
+  n_classes_ = matrices.size();
+  n_cells_ = static_cast<size_t>( (x_axis_.n_bins+2)*(y_axis_.n_bins+2) );
+  efficiencies_.assign( n_classes_*n_cells_, 0.0f );
+  for( size_t c=0; c<n_classes_; ++c )
+    for( int x=0; x<x_axis_.n_bins+2; ++x )
+      for( int y=0; y<y_axis_.n_bins+2; ++y )
+        efficiencies_[ c*n_cells_ + x*(y_axis_.n_bins+2) + y ] = matrices[c]->GetBinContent(x, y);
+  file->Close();
+}
+
+void EfficiencyTable::ReadBinaryFile(const std::string &file_name) {
+  std::ifstream in(file_name, std::ios::binary);
+  char magic[sizeof(kMagic)]{};
+  in.read(magic, sizeof(magic));
+  uint32_t n_classes{0};
+  ReadValue(in, n_classes);
+  ReadValue(in, x_axis_.n_bins);
+  ReadValue(in, x_axis_.min);
+  ReadValue(in, x_axis_.max);
+  ReadValue(in, y_axis_.n_bins);
+  ReadValue(in, y_axis_.min);
+  ReadValue(in, y_axis_.max);
+  if( !in || x_axis_.n_bins <= 0 || y_axis_.n_bins <= 0 )
+    throw std::runtime_error( "Efficiency table " + file_name + " is corrupted" );
+  n_classes_ = n_classes;
+  n_cells_ = static_cast<size_t>( (x_axis_.n_bins+2)*(y_axis_.n_bins+2) );
+  efficiencies_.assign( n_classes_*n_cells_, 0.0f );
+  in.read( reinterpret_cast<char*>(efficiencies_.data()), efficiencies_.size()*sizeof(float) );
+  if( !in )
+    throw std::runtime_error( "Efficiency table " + file_name + " is truncated" );
+}
+
+void EfficiencyTable::Write(const std::string &file_name) const {
+  // native byte order: the table is a cache for the machines of one cluster, not an exchange format
+  std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+  if( !out )
+    throw std::runtime_error( "Cannot write efficiency table " + file_name );
+  out.write(kMagic, sizeof(kMagic));
+  WriteValue(out, static_cast<uint32_t>(n_classes_));
+  WriteValue(out, x_axis_.n_bins);
+  WriteValue(out, x_axis_.min);
+  WriteValue(out, x_axis_.max);
+  WriteValue(out, y_axis_.n_bins);
+  WriteValue(out, y_axis_.min);
+  WriteValue(out, y_axis_.max);
+  out.write( reinterpret_cast<const char*>(efficiencies_.data()), efficiencies_.size()*sizeof(float) );
+}
+
+void EfficiencyTable::BuildWeights() {
+  weights_.assign( efficiencies_.size(), 0.0 );
+  for( size_t i=0; i<efficiencies_.size(); ++i ){
+    double eff = efficiencies_[i];
+    if( eff >= kMinEfficiency )
+      weights_[i] = 1.0 / eff;
+  }
+}
+
+} // namespace AnalysisTree
@@ -0,0 +1,64 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_EFFICIENCY_TABLE_H_
+#define HADES_CONTAMINATIONS_SRC_EFFICIENCY_TABLE_H_
+
+#include <string>
+#include <vector>
+
+#include <TH2F.h>
+
+namespace AnalysisTree {
+
+/* Protons efficiency as a function of centrality class, y and pT,
+ * flattened into one contiguous centrality x y x pT table.
+ * The inverse efficiency used as a weight is precomputed, 0 below the minimal efficiency, so the per-proton
+ * lookup is bin arithmetic and two loads: the weight at y and the check of the mirrored efficiency at -y.
+ * The bin of -y is found for each proton, so the result does not depend on the binning being symmetric. */
+class EfficiencyTable {
+public:
+  static constexpr double kMinEfficiency = 0.1; // protons in bins with lower efficiency (or mirrored efficiency) are rejected
+
+  // reads efficiency_N matrices from a ROOT file or a binary table written with Write()
+  void Load(const std::string& file_name);
+  void Write(const std::string& file_name) const;
+  size_t GetNClasses() const { return n_classes_; }
+  // 1/efficiency for protons at (y, pT), 0 if the proton has to be rejected
+  double GetWeight(size_t centrality_class, double y, double pT) const {
+    auto n_y = static_cast<size_t>(y_axis_.n_bins+2);
+    auto cells = weights_.data() + centrality_class*n_cells_ + y_axis_.FindBin(pT);
+    if( cells[ x_axis_.FindBin(-y)*n_y ] == 0.0 ) // low efficiency of the mirrored proton
+      return 0.0;
+    return cells[ x_axis_.FindBin(y)*n_y ];
+  }
+
+private:
+  // uniform binning with the same convention as TAxis: 0 is underflow and n_bins+1 is overflow
+  struct Binning{
+    int n_bins{0};
+    double min{0.0};
+    double max{0.0};
+    int FindBin(double x) const {
+      if( x < min )
+        return 0;
+      if( !(x < max) )
+        return n_bins+1;
+      return 1 + static_cast<int>( n_bins*(x-min)/(max-min) );
+    }
+  };
+  void ReadRootFile(const std::string& file_name);
+  void ReadBinaryFile(const std::string& file_name);
+  void BuildWeights();
+
+  size_t n_classes_{0};
+  size_t n_cells_{0};
+  Binning x_axis_; // rapidity
+  Binning y_axis_; // transverse momentum
+  std::vector<float> efficiencies_; // bin contents including under- and overflow
+  std::vector<double> weights_; // 1/efficiency, 0 for efficiency below kMinEfficiency
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_EFFICIENCY_TABLE_H_
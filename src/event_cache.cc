@@ -0,0 +1,152 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "event_cache.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace AnalysisTree {
+
+namespace {
+constexpr char kMagic[8] = {'H','E','V','C','A','C','H','E'};
+constexpr uint32_t kVersion = 2; // 2: the sampling of the run in the header
+constexpr size_t kBufferSize = 4 << 20;
+
+static_assert( std::is_trivially_copyable<AnalysisTask::EventRecord>::value, "EventRecord is written as it is" );
+static_assert( std::is_trivially_copyable<AnalysisTask::ProtonRecord>::value, "ProtonRecord is written as it is" );
+static_assert( sizeof(EventCacheHeader) % alignof(AnalysisTask::EventRecord) == 0, "records after the header must stay aligned" );
+
+// maps the whole file read-only, returns nullptr for an empty file
+void* MapFile(const std::string& file_name, size_t& size){
+  auto fd = open(file_name.c_str(), O_RDONLY);
+  if( fd < 0 )
+    throw std::runtime_error( "Cannot open event cache " + file_name );
+  struct stat file_stat{};
+  fstat(fd, &file_stat);
+  size = static_cast<size_t>(file_stat.st_size);
+  void* map{nullptr};
+  if( size > 0 ){
+    map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if( map == MAP_FAILED ){
+      close(fd);
+      throw std::runtime_error( "Cannot map event cache " + file_name );
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  return map;
+}
+} // namespace
+
+EventCacheWriter::EventCacheWriter(std::string file_name) : file_name_(std::move(file_name)),
+                                                            events_buffer_(kBufferSize),
+                                                            protons_buffer_(kBufferSize) {
+  events_file_ = fopen(file_name_.c_str(), "wb");
+  protons_file_ = fopen((file_name_+".protons").c_str(), "wb");
+  if( !events_file_ || !protons_file_ )
+    throw std::runtime_error( "Cannot create event cache " + file_name_ );
+  setvbuf(events_file_, events_buffer_.data(), _IOFBF, events_buffer_.size());
+  setvbuf(protons_file_, protons_buffer_.data(), _IOFBF, protons_buffer_.size());
+  std::memcpy(header_.magic, kMagic, sizeof(kMagic));
+  header_.version = kVersion;
+  header_.event_record_size = sizeof(AnalysisTask::EventRecord);
+  header_.proton_record_size = sizeof(AnalysisTask::ProtonRecord);
+  header_.sampling_fraction = 1.0;
+  // the header is rewritten with the final counters at Close()
+  fwrite(&header_, sizeof(header_), 1, events_file_);
+}
+
+EventCacheWriter::~EventCacheWriter() {
+  try {
+    Close();
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+void EventCacheWriter::Write(const AnalysisTask::EventRecord &event, const AnalysisTask::ProtonRecord *protons) {
+  fwrite(&event, sizeof(event), 1, events_file_);
+  if( event.n_protons > 0 )
+    fwrite(protons, sizeof(AnalysisTask::ProtonRecord), event.n_protons, protons_file_);
+  header_.n_events++;
+  header_.n_protons+=event.n_protons;
+}
+
+void EventCacheWriter::SetSampling(double fraction, uint64_t input_entries, uint64_t sampled_entries) {
+  header_.sampling_fraction = fraction;
+  header_.input_entries = input_entries;
+  header_.sampled_entries = sampled_entries;
+}
+
+void EventCacheWriter::Close() {
+  if( !events_file_ )
+    return;
+  fseek(events_file_, 0, SEEK_SET);
+  fwrite(&header_, sizeof(header_), 1, events_file_);
+  auto failed = ferror(events_file_) || ferror(protons_file_);
+  fclose(events_file_);
+  fclose(protons_file_);
+  events_file_ = nullptr;
+  protons_file_ = nullptr;
+  if( failed )
+    throw std::runtime_error( "Error while writing event cache " + file_name_ );
+}
+
+EventCacheReader::EventCacheReader(const std::string &file_name) {
+  events_map_ = MapFile(file_name, events_map_size_);
+  protons_map_ = MapFile(file_name+".protons", protons_map_size_);
+  if( events_map_size_ < sizeof(EventCacheHeader) )
+    throw std::runtime_error( "Event cache " + file_name + " is truncated" );
+  std::memcpy(&header_, events_map_, sizeof(header_));
+  if( std::memcmp(header_.magic, kMagic, sizeof(kMagic)) != 0 || header_.version != kVersion )
+    throw std::runtime_error( file_name + " is not an event cache of this version" );
+  if( header_.event_record_size != sizeof(AnalysisTask::EventRecord) ||
+      header_.proton_record_size != sizeof(AnalysisTask::ProtonRecord) )
+    throw std::runtime_error( "Event cache " + file_name + " was written with a different record layout" );
+  if( events_map_size_ != sizeof(EventCacheHeader) + header_.n_events*sizeof(AnalysisTask::EventRecord) ||
+      protons_map_size_ != header_.n_protons*sizeof(AnalysisTask::ProtonRecord) )
+    throw std::runtime_error( "Event cache " + file_name + " is incomplete" );
+  events_ = reinterpret_cast<const AnalysisTask::EventRecord*>( static_cast<const char*>(events_map_) + sizeof(EventCacheHeader) );
+  protons_ = static_cast<const AnalysisTask::ProtonRecord*>(protons_map_);
+}
+
+EventCacheReader::~EventCacheReader() {
+  if( events_map_ )
+    munmap(events_map_, events_map_size_);
+  if( protons_map_ )
+    munmap(protons_map_, protons_map_size_);
+}
+
+uint64_t EventCacheReader::Replay(AnalysisTask &task) const {
+  auto protons = protons_;
+  for( uint64_t i=0; i<header_.n_events; ++i ){
+    task.FillEvent(events_[i], protons);
+    protons+=events_[i].n_protons;
+  }
+  return header_.n_events;
+}
+
+std::vector<std::string> FindEventCacheFiles(const std::string &base_name) {
+  std::vector<std::string> file_names;
+  struct stat file_stat{};
+  for( int i=0; ; ++i ){
+    auto file_name = base_name + "." + std::to_string(i);
+    if( stat(file_name.c_str(), &file_stat) != 0 )
+      break;
+    file_names.push_back(file_name);
+  }
+  if( file_names.empty() )
+    throw std::runtime_error( "No event cache files " + base_name + ".N found" );
+  return file_names;
+}
+
+} // namespace AnalysisTree
@@ -0,0 +1,82 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_EVENT_CACHE_H_
+#define HADES_CONTAMINATIONS_SRC_EVENT_CACHE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "analysis_task.h"
+
+namespace AnalysisTree {
+
+/* Cache of the derived per-event values of AnalysisTask, to refill the histograms with different binning
+ * without rereading the AnalysisTree.
+ * A cache consists of two files of fixed-width records in native byte order:
+ * <name> holds a header and AnalysisTask::EventRecord-s, <name>.protons holds AnalysisTask::ProtonRecord-s
+ * in the same event order. Both are memory-mapped when replayed. */
+struct EventCacheHeader{
+  char magic[8];
+  uint32_t version;
+  uint32_t event_record_size;
+  uint32_t proton_record_size;
+  uint32_t reserved;
+  uint64_t n_events;
+  uint64_t n_protons;
+  // prescale of the run the events were selected from (1 for all entries) and the entries it was applied to,
+  // written to the output of the replay as the sampling tags
+  double sampling_fraction;
+  uint64_t input_entries;
+  uint64_t sampled_entries;
+};
+
+class EventCacheWriter {
+public:
+  explicit EventCacheWriter(std::string file_name);
+  ~EventCacheWriter();
+  EventCacheWriter(const EventCacheWriter&) = delete;
+  EventCacheWriter& operator=(const EventCacheWriter&) = delete;
+  void Write(const AnalysisTask::EventRecord& event, const AnalysisTask::ProtonRecord* protons);
+  // stored in the header at Close()
+  void SetSampling(double fraction, uint64_t input_entries, uint64_t sampled_entries);
+  void Close();
+private:
+  std::string file_name_;
+  FILE* events_file_{nullptr};
+  FILE* protons_file_{nullptr};
+  std::vector<char> events_buffer_;
+  std::vector<char> protons_buffer_;
+  EventCacheHeader header_{};
+};
+
+class EventCacheReader {
+public:
+  explicit EventCacheReader(const std::string& file_name);
+  ~EventCacheReader();
+  EventCacheReader(const EventCacheReader&) = delete;
+  EventCacheReader& operator=(const EventCacheReader&) = delete;
+  uint64_t GetNEvents() const { return header_.n_events; }
+  double GetSamplingFraction() const { return header_.sampling_fraction; }
+  uint64_t GetInputEntries() const { return header_.input_entries; }
+  uint64_t GetSampledEntries() const { return header_.sampled_entries; }
+  // fills the task's histograms with all cached events, returns the number of events
+  uint64_t Replay(AnalysisTask& task) const;
+private:
+  EventCacheHeader header_{};
+  const AnalysisTask::EventRecord* events_{nullptr};
+  const AnalysisTask::ProtonRecord* protons_{nullptr};
+  void* events_map_{nullptr};
+  size_t events_map_size_{0};
+  void* protons_map_{nullptr};
+  size_t protons_map_size_{0};
+};
+
+// event caches written by several threads are named <base>.0, <base>.1, ...
+std::vector<std::string> FindEventCacheFiles(const std::string& base_name);
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_EVENT_CACHE_H_
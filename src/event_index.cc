@@ -0,0 +1,187 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "event_index.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TUUID.h>
+
+#include <AnalysisTree/Configuration.hpp>
+#include <AnalysisTree/EventHeader.hpp>
+
+namespace AnalysisTree {
+
+namespace {
+// unknown values are the largest value of the column
+constexpr uint8_t kUnknownByte = std::numeric_limits<uint8_t>::max();
+constexpr uint16_t kUnknownShort = std::numeric_limits<uint16_t>::max();
+
+template<typename T>
+T Encode(double value, T unknown){
+  if( !(value >= 0.0 && value < unknown) || value != std::floor(value) )
+    return unknown;
+  return static_cast<T>(value);
+}
+template<typename T>
+float Decode(T value, T unknown){
+  return value == unknown ? std::numeric_limits<float>::quiet_NaN() : static_cast<float>(value);
+}
+} // namespace
+
+constexpr char EventIndex::kMagic[8];
+constexpr size_t EventIndex::kInputIdSize;
+constexpr std::array<size_t, EventIndex::N_FIELDS> EventIndex::kSizes;
+
+const char *EventIndex::GetFieldName(int field) {
+  static constexpr std::array<const char*, N_FIELDS> names{
+      "physical_trigger_2", "physical_trigger_3", "selected_mdc_tracks", "vtx_z" };
+  return names.at(field);
+}
+
+int EventIndex::FindField(const std::string &name) {
+  for( int field=0; field<N_FIELDS; ++field )
+    if( name == GetFieldName(field) )
+      return field;
+  return N_FIELDS;
+}
+
+std::string EventIndex::GetFileName(const std::string &input_file, const std::string &index_dir) {
+  if( index_dir.empty() )
+    return input_file + ".index";
+  auto slash = input_file.rfind('/');
+  return index_dir + "/" + ( slash == std::string::npos ? input_file : input_file.substr(slash+1) ) + ".index";
+}
+
+long long EventIndex::Build(const std::string &input_file, const std::string &tree_name, const std::string &index_file) {
+  std::unique_ptr<TFile> file( TFile::Open(input_file.c_str(), "read") );
+  if( !file || file->IsZombie() )
+    throw std::runtime_error( "EventIndex: cannot open " + input_file );
+  Configuration* config{nullptr};
+  file->GetObject("Configuration", config);
+  TTree* tree{nullptr};
+  file->GetObject(tree_name.c_str(), tree);
+  if( !config || !tree )
+    throw std::runtime_error( "EventIndex: no Configuration or " + tree_name + " in " + input_file );
+  std::string input_id = file->GetUUID().AsString();
+  input_id.resize(kInputIdSize, ' ');
+  const auto& event_header_config = config->GetBranchConfig("event_header");
+  std::array<ShortInt_t, N_FIELDS> ids{};
+  std::array<Types, N_FIELDS> types{};
+  for( int field=0; field<N_FIELDS; ++field ){
+    auto id = event_header_config.GetFieldId(GetFieldName(field));
+    if( id == UndefValueShort )
+      throw std::runtime_error( "EventIndex: no field " + std::string(GetFieldName(field)) + " in event_header of " + input_file );
+    ids[field] = static_cast<ShortInt_t>(id);
+    types[field] = event_header_config.GetFieldType(GetFieldName(field));
+  }
+  auto event_header = new EventHeader;
+  tree->SetBranchStatus("*", false);
+  tree->SetBranchStatus("event_header", true);
+  tree->SetBranchStatus("event_header.*", true);
+  tree->SetBranchAddress("event_header", &event_header);
+
+  auto n_entries = tree->GetEntries();
+  std::vector<uint8_t> physical_trigger_2(n_entries);
+  std::vector<uint8_t> physical_trigger_3(n_entries);
+  std::vector<uint16_t> tracks_mdc(n_entries);
+  std::vector<float> vtx_z(n_entries);
+  auto get_value = [&event_header, &ids, &types](int field) -> double {
+    switch (types[field]) {
+    case Types::kInteger: return event_header->GetField<int>(ids[field]);
+    case Types::kBool: return event_header->GetField<bool>(ids[field]);
+    default: return event_header->GetField<float>(ids[field]);
+    }
+  };
+  for( long long entry=0; entry<n_entries; ++entry ){
+    tree->GetEntry(entry);
+    physical_trigger_2[entry] = Encode(get_value(PHYSICAL_TRIGGER_2), kUnknownByte);
+    physical_trigger_3[entry] = Encode(get_value(PHYSICAL_TRIGGER_3), kUnknownByte);
+    tracks_mdc[entry] = Encode(get_value(TRACKS_MDC), kUnknownShort);
+    vtx_z[entry] = static_cast<float>( get_value(VTX_Z) );
+  }
+  file->Close();
+  delete event_header;
+
+  // the index appears complete or not at all
+  auto temporary_file = index_file + ".tmp";
+  {
+    std::ofstream out(temporary_file, std::ios::binary);
+    if( !out )
+      throw std::runtime_error( "EventIndex: cannot write " + temporary_file );
+    int64_t n = n_entries;
+    out.write(kMagic, sizeof(kMagic));
+    out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    out.write(input_id.data(), kInputIdSize);
+    out.write(reinterpret_cast<const char*>(physical_trigger_2.data()), n_entries*kSizes[PHYSICAL_TRIGGER_2]);
+    out.write(reinterpret_cast<const char*>(physical_trigger_3.data()), n_entries*kSizes[PHYSICAL_TRIGGER_3]);
+    out.write(reinterpret_cast<const char*>(tracks_mdc.data()), n_entries*kSizes[TRACKS_MDC]);
+    out.write(reinterpret_cast<const char*>(vtx_z.data()), n_entries*kSizes[VTX_Z]);
+    if( !out )
+      throw std::runtime_error( "EventIndex: cannot write " + temporary_file );
+  }
+  if( std::rename(temporary_file.c_str(), index_file.c_str()) != 0 )
+    throw std::runtime_error( "EventIndex: cannot rename " + temporary_file + " to " + index_file );
+  return n_entries;
+}
+
+EventIndex::EventIndex(std::string index_file, long long n_entries) :
+    index_file_(std::move(index_file)), n_entries_(n_entries) {
+  std::ifstream in(index_file_, std::ios::binary);
+  if( !in )
+    return;
+  char magic[sizeof(kMagic)];
+  int64_t n{-1};
+  std::string input_id(kInputIdSize, ' ');
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&n), sizeof(n));
+  in.read(&input_id[0], kInputIdSize);
+  is_valid_ = in && std::memcmp(magic, kMagic, sizeof(kMagic)) == 0 && n == n_entries_;
+  if( is_valid_ )
+    input_id_ = input_id;
+}
+
+void EventIndex::Read(long long first, long long n, Values &values) const {
+  if( !is_valid_ || first < 0 || first+n > n_entries_ )
+    throw std::runtime_error( "EventIndex: entries are out of the index " + index_file_ );
+  std::ifstream in(index_file_, std::ios::binary);
+  std::vector<char> buffer;
+  auto column_offset = GetHeaderSize();
+  for( int field=0; field<N_FIELDS; ++field ){
+    buffer.resize( n*kSizes[field] );
+    in.seekg( column_offset + first*kSizes[field] );
+    in.read( buffer.data(), buffer.size() );
+    if( !in )
+      throw std::runtime_error( "EventIndex: cannot read " + index_file_ );
+    column_offset+=n_entries_*kSizes[field];
+    auto& column = values[field];
+    column.resize(n);
+    for( long long i=0; i<n; ++i ){
+      auto bytes = buffer.data() + i*kSizes[field];
+      switch (field) {
+      case TRACKS_MDC: {
+        uint16_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+        column[i] = Decode(value, kUnknownShort);
+        break;
+      }
+      case VTX_Z:
+        std::memcpy(&column[i], bytes, sizeof(float));
+        break;
+      default:
+        column[i] = Decode(static_cast<uint8_t>(*bytes), kUnknownByte);
+      }
+    }
+  }
+}
+
+} // namespace AnalysisTree
@@ -0,0 +1,59 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_EVENT_INDEX_H_
+#define HADES_CONTAMINATIONS_SRC_EVENT_INDEX_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace AnalysisTree {
+
+/* Sidecar of an input file with the event header values the event selections mostly cut on, one per entry:
+ * physical_trigger_2, physical_trigger_3 (1 byte each), selected_mdc_tracks (2 bytes) and vtx_z (float).
+ * The values are stored as columns after a header with the magic, the number of entries and the UUID of the input
+ * file, so a range of entries is read with one read per column. The UUID changes whenever the input file is written
+ * again, so an index left from an earlier production of the file is not used. Values which do not fit into the column (e.g. a trigger above 254) are stored
+ * as unknown and read back as NaN: an entry with an unknown value cannot be rejected by the index.
+ * The index does not select events, it only tells which entries certainly fail a cut and need not be read. */
+class EventIndex {
+public:
+  enum FIELDS {
+    PHYSICAL_TRIGGER_2,
+    PHYSICAL_TRIGGER_3,
+    TRACKS_MDC,
+    VTX_Z,
+    N_FIELDS
+  };
+  using Values = std::array<std::vector<float>, N_FIELDS>; // per field, one value per entry
+  static const char* GetFieldName(int field); // name of the event header field
+  static int FindField(const std::string& name); // N_FIELDS if the field is not in the index
+  // <input_file>.index, or <index_dir>/<name of the input file>.index
+  static std::string GetFileName(const std::string& input_file, const std::string& index_dir);
+  // reads the event headers of the tree in the input file and writes the index, returns the number of entries
+  static long long Build(const std::string& input_file, const std::string& tree_name, const std::string& index_file);
+
+  // opens the index, IsValid() is false if there is no index or it has a different number of entries
+  EventIndex(std::string index_file, long long n_entries);
+  bool IsValid() const { return is_valid_; }
+  // UUID of the input file the index was built for, as given by TUUID::AsString()
+  const std::string& GetInputId() const { return input_id_; }
+  // values of the entries [first, first+n) of the file
+  void Read(long long first, long long n, Values& values) const;
+
+private:
+  static constexpr char kMagic[8] = {'H', 'A', 'D', 'E', 'S', 'I', 'X', '2'};
+  static constexpr size_t kInputIdSize = 36; // characters of a UUID string
+  static constexpr std::array<size_t, N_FIELDS> kSizes{ 1, 1, 2, 4 }; // bytes per value of each column
+  static size_t GetHeaderSize() { return sizeof(kMagic) + sizeof(int64_t) + kInputIdSize; }
+  std::string index_file_;
+  long long n_entries_;
+  std::string input_id_;
+  bool is_valid_{false};
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_EVENT_INDEX_H_
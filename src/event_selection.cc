@@ -0,0 +1,105 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "event_selection.h"
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace AnalysisTree {
+
+namespace {
+bool IsVertex(const std::string& field){
+  return field == "vtx_x" || field == "vtx_y" || field == "vtx_z";
+}
+} // namespace
+
+std::vector<EventSelection::Cut> EventSelection::Parse(const std::string &expression) {
+  std::vector<Cut> cuts;
+  std::istringstream items(expression);
+  std::string item;
+  while( std::getline(items, item, ',') ){
+    if( item.empty() )
+      continue;
+    auto equal_sign = item.find('=');
+    if( equal_sign == std::string::npos || equal_sign == 0 )
+      throw std::runtime_error( "Cut " + item + " is not field=min:max or field=value" );
+    Cut cut{ item.substr(0, equal_sign), 0.0, 0.0 };
+    auto range = item.substr(equal_sign+1);
+    auto colon = range.find(':');
+    try {
+      if( colon == std::string::npos )
+        cut.min = cut.max = std::stod(range);
+      else {
+        cut.min = std::stod(range.substr(0, colon));
+        cut.max = std::stod(range.substr(colon+1));
+      }
+    } catch (std::exception&) {
+      throw std::runtime_error( "Cut " + item + " has a wrong range" );
+    }
+    if( cut.min > cut.max )
+      throw std::runtime_error( "Cut " + item + " has min greater than max" );
+    cuts.push_back(cut);
+  }
+  return cuts;
+}
+
+void EventSelection::Init(const Configuration &config) {
+  const auto& event_header_config = config.GetBranchConfig("event_header");
+  checks_.clear();
+  for( size_t i=0; i<cuts_.size(); ++i ){
+    const auto& cut = cuts_[i];
+    auto id = event_header_config.GetFieldId(cut.field);
+    if( id == UndefValueShort )
+      throw std::runtime_error( "EventSelection " + name_ + ": no field " + cut.field + " in event_header" );
+    checks_.push_back( { static_cast<ShortInt_t>(id), event_header_config.GetFieldType(cut.field), cut.min, cut.max, i, 0, 0 } );
+  }
+}
+
+std::vector<std::string> EventSelection::GetColumns() const {
+  std::set<std::string> columns;
+  for( const auto& check : checks_ ){
+    if( IsVertex(cuts_[check.cut].field) )
+      columns.insert("vtx_pos_");
+    else if( check.type == Types::kInteger )
+      columns.insert("ints_");
+    else if( check.type == Types::kBool )
+      columns.insert("bools_");
+    else
+      columns.insert("floats_");
+  }
+  return {columns.begin(), columns.end()};
+}
+
+void EventSelection::Reorder() {
+  // for independent cuts of the same cost the expected number of checks is minimal when the most rejecting go first
+  std::stable_sort( checks_.begin(), checks_.end(), [](const Check& a, const Check& b){
+    return double(a.n_rejected) / std::max<uint64_t>(a.n_evaluated, 1) > double(b.n_rejected) / std::max<uint64_t>(b.n_evaluated, 1);
+  } );
+}
+
+void EventSelection::AddCounters(const EventSelection &other) {
+  n_events_+=other.n_events_;
+  n_selected_+=other.n_selected_;
+  for( auto& check : checks_ )
+    for( const auto& other_check : other.checks_ )
+      if( other_check.cut == check.cut ){
+        check.n_evaluated+=other_check.n_evaluated;
+        check.n_rejected+=other_check.n_rejected;
+      }
+}
+
+void EventSelection::Print() const {
+  std::cout << "EventSelection " << name_ << ": " << n_selected_ << " of " << n_events_ << " events selected" << std::endl;
+  for( const auto& check : checks_ ){
+    const auto& cut = cuts_[check.cut];
+    std::cout << "  " << cut.field << " in [" << cut.min << ", " << cut.max << "]: evaluated " << check.n_evaluated
+              << ", rejected " << check.n_rejected << std::endl;
+  }
+}
+
+} // namespace AnalysisTree
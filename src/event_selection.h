@@ -0,0 +1,79 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_EVENT_SELECTION_H_
+#define HADES_CONTAMINATIONS_SRC_EVENT_SELECTION_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <AnalysisTree/Configuration.hpp>
+#include <AnalysisTree/EventHeader.hpp>
+
+namespace AnalysisTree {
+
+/* Event cuts on the event header fields, compiled at Init() into a flat list of range checks over resolved field ids.
+ * An event is selected if min <= value <= max for every cut, as with SimpleCut. The checks are evaluated until the
+ * first rejection, and are periodically reordered so the ones rejecting most events go first.
+ * The numbers of evaluated and rejected events are counted per cut. Counters and the order are per object,
+ * so every thread works on its own copy. */
+class EventSelection {
+public:
+  struct Cut{
+    std::string field; // field of the event header, vtx_x, vtx_y and vtx_z are the vertex
+    double min;
+    double max;
+  };
+  EventSelection(std::string name, std::vector<Cut> cuts) : name_(std::move(name)), cuts_(std::move(cuts)) {}
+  // cuts as a comma separated list of field=min:max or field=value, e.g. "selected_mdc_tracks=2:999,physical_trigger_3=1"
+  static std::vector<Cut> Parse(const std::string& expression);
+  void Init(const Configuration& config);
+  bool Apply(const EventHeader& event_header) {
+    if( ++n_events_ % kReorderInterval == 0 )
+      Reorder();
+    for( auto& check : checks_ ){
+      check.n_evaluated++;
+      double value;
+      switch (check.type) {
+      case Types::kInteger: value = event_header.GetField<int>(check.id); break;
+      case Types::kBool: value = event_header.GetField<bool>(check.id); break;
+      default: value = event_header.GetField<float>(check.id);
+      }
+      if( value < check.min || value > check.max ){
+        check.n_rejected++;
+        return false;
+      }
+    }
+    n_selected_++;
+    return true;
+  }
+  // members of the event header the cuts read: ints_, floats_, bools_ or vtx_pos_
+  std::vector<std::string> GetColumns() const;
+  void AddCounters(const EventSelection& other); // counters of a copy used by another thread
+  void Print() const;
+  const std::string& GetName() const { return name_; }
+  const std::vector<Cut>& GetCuts() const { return cuts_; }
+private:
+  static constexpr uint64_t kReorderInterval = 4096;
+  struct Check{
+    ShortInt_t id;
+    Types type;
+    double min;
+    double max;
+    size_t cut; // index in cuts_
+    uint64_t n_evaluated;
+    uint64_t n_rejected;
+  };
+  void Reorder();
+
+  std::string name_;
+  std::vector<Cut> cuts_;
+  std::vector<Check> checks_; // in the order of evaluation
+  uint64_t n_events_{0};
+  uint64_t n_selected_{0};
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_EVENT_SELECTION_H_
@@ -0,0 +1,99 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "file_prefetcher.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace AnalysisTree {
+
+namespace {
+constexpr size_t kChunkSize = 4 << 20;
+} // namespace
+
+FilePrefetcher::FilePrefetcher(std::vector<std::string> file_names, size_t depth, size_t budget) :
+    file_names_(std::move(file_names)), depth_(depth), budget_(budget) {
+  file_sizes_.reserve(file_names_.size());
+  for( const auto& file_name : file_names_ ){
+    struct stat file_stat{};
+    auto is_local = file_name.find("://") == std::string::npos && stat(file_name.c_str(), &file_stat) == 0;
+    file_sizes_.push_back( is_local ? static_cast<size_t>(file_stat.st_size) : 0 );
+  }
+  thread_ = std::thread( [this](){ Run(); } );
+}
+
+FilePrefetcher::~FilePrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopped_ = true;
+  }
+  condition_.notify_one();
+  thread_.join();
+}
+
+void FilePrefetcher::SetPosition(size_t position) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if( position <= position_ )
+      return;
+    position_ = position;
+  }
+  condition_.notify_one();
+}
+
+void FilePrefetcher::Run() {
+  size_t next{0}; // next file to prefetch
+  std::unique_lock<std::mutex> lock(mutex_);
+  while( !is_stopped_ && next < file_names_.size() ){
+    next = std::max(next, position_+1); // the current file is already being read by the event loop
+    if( next >= file_names_.size() )
+      break;
+    size_t bytes_ahead{0};
+    for( auto i=position_+1; i<next; ++i )
+      bytes_ahead+=file_sizes_[i];
+    if( next > position_+depth_ || (next > position_+1 && bytes_ahead+file_sizes_[next] > budget_) ){
+      condition_.wait(lock);
+      continue;
+    }
+    auto file_name = file_names_[next];
+    auto size = file_sizes_[next];
+    lock.unlock();
+    auto is_completed = size == 0 || Prefetch(file_name, size);
+    lock.lock();
+    if( !is_completed )
+      break;
+    next++;
+  }
+}
+
+bool FilePrefetcher::Prefetch(const std::string &file_name, size_t size) {
+  auto fd = open(file_name.c_str(), O_RDONLY);
+  if( fd < 0 ){
+    std::cerr << "FilePrefetcher: cannot open " << file_name << std::endl;
+    return true;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  // the kernel may ignore the advice on network file systems, reading the file makes sure it is cached
+  std::vector<char> buffer(kChunkSize);
+  for( size_t offset=0; offset<size; offset+=kChunkSize ){
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if( is_stopped_ ){
+        close(fd);
+        return false;
+      }
+    }
+    if( pread(fd, buffer.data(), kChunkSize, static_cast<off_t>(offset)) <= 0 )
+      break;
+  }
+  close(fd);
+  return true;
+}
+
+} // namespace AnalysisTree
@@ -0,0 +1,42 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_FILE_PREFETCHER_H_
+#define HADES_CONTAMINATIONS_SRC_FILE_PREFETCHER_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace AnalysisTree {
+
+/* Reads the input files ahead of the event loop on a background thread, so they are in the page cache
+ * when the event loop opens them instead of stalling on the file system.
+ * The files are read in the order they are going to be processed, at most `depth` files ahead of the
+ * file being processed and at most `budget` bytes ahead in total. Remote files (URLs) are skipped. */
+class FilePrefetcher {
+public:
+  FilePrefetcher(std::vector<std::string> file_names, size_t depth, size_t budget);
+  ~FilePrefetcher();
+  // the event loop started to process the file at the position in the list, the files before it are not needed
+  void SetPosition(size_t position);
+private:
+  void Run();
+  bool Prefetch(const std::string& file_name, size_t size); // false if stopped
+
+  std::vector<std::string> file_names_;
+  std::vector<size_t> file_sizes_;
+  size_t depth_;
+  size_t budget_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  size_t position_{0}; // first file still needed by the event loop
+  bool is_stopped_{false};
+  std::thread thread_;
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_FILE_PREFETCHER_H_
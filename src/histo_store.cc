@@ -0,0 +1,155 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "histo_store.h"
+
+#include <stdexcept>
+
+namespace AnalysisTree {
+
+HistoStore::HistoStore(std::string name, std::string title, std::vector<Axis> axes, STORAGE storage) :
+    name_(std::move(name)), title_(std::move(title)), axes_(std::move(axes)), storage_(storage) {
+  if( axes_.size() != 2 && axes_.size() != 3 )
+    throw std::runtime_error( "HistoStore " + name_ + ": only 2D and 3D histograms are supported" );
+  for( const auto& axis : axes_ )
+    n_cells_*= static_cast<size_t>(axis.n_bins+2);
+}
+
+void HistoStore::Fill(double x, double y) {
+  entries_++;
+  auto bin_x = axes_[0].FindBin(x);
+  auto bin_y = axes_[1].FindBin(y);
+  AddBinContent( bin_x + (axes_[0].n_bins+2)*bin_y, 1.0f );
+  if( bin_x == 0 || bin_x > axes_[0].n_bins )
+    return;
+  if( bin_y == 0 || bin_y > axes_[1].n_bins )
+    return;
+  stats_[0]+=1; stats_[1]+=1;
+  stats_[2]+=x; stats_[3]+=x*x;
+  stats_[4]+=y; stats_[5]+=y*y;
+  stats_[6]+=x*y;
+}
+
+void HistoStore::Fill(double x, double y, double z) {
+  entries_++;
+  auto bin_x = axes_[0].FindBin(x);
+  auto bin_y = axes_[1].FindBin(y);
+  auto bin_z = axes_[2].FindBin(z);
+  AddBinContent( bin_x + (axes_[0].n_bins+2)*( bin_y + (axes_[1].n_bins+2)*bin_z ), 1.0f );
+  if( bin_x == 0 || bin_x > axes_[0].n_bins )
+    return;
+  if( bin_y == 0 || bin_y > axes_[1].n_bins )
+    return;
+  if( bin_z == 0 || bin_z > axes_[2].n_bins )
+    return;
+  stats_[0]+=1; stats_[1]+=1;
+  stats_[2]+=x; stats_[3]+=x*x;
+  stats_[4]+=y; stats_[5]+=y*y;
+  stats_[6]+=x*y;
+  stats_[7]+=z; stats_[8]+=z*z;
+  stats_[9]+=x*z; stats_[10]+=y*z;
+}
+
+void HistoStore::AddBinContent(int32_t bin, float value) {
+  if( storage_ == STORAGE::SPARSE ){
+    sparse_bins_.Add(bin, value);
+    return;
+  }
+  if( dense_bins_.empty() )
+    dense_bins_.assign(n_cells_, 0.0f);
+  dense_bins_[bin]+=value;
+}
+
+void HistoStore::Add(const HistoStore *other) {
+  if( other->n_cells_ != n_cells_ || other->axes_.size() != axes_.size() )
+    throw std::runtime_error( "HistoStore " + name_ + ": cannot add histogram with different binning" );
+  if( other->storage_ == STORAGE::SPARSE )
+    other->sparse_bins_.ForEach( [this](int32_t bin, float value){ AddBinContent(bin, value); } );
+  else
+    for( size_t bin=0; bin<other->dense_bins_.size(); ++bin )
+      if( other->dense_bins_[bin] != 0.0f )
+        AddBinContent(bin, other->dense_bins_[bin]);
+  entries_+=other->entries_;
+  for( size_t i=0; i<stats_.size(); ++i )
+    stats_[i]+=other->stats_[i];
+}
+
+void HistoStore::AddHisto(const TH1 *histo) {
+  const TAxis* histo_axes[] = { histo->GetXaxis(), histo->GetYaxis(), histo->GetZaxis() };
+  auto is_same_binning = static_cast<size_t>(histo->GetNcells()) == n_cells_ && histo->GetDimension() == static_cast<int>(axes_.size());
+  for( size_t i=0; i<axes_.size() && is_same_binning; ++i )
+    is_same_binning = axes_[i].HasBinning(histo_axes[i]);
+  if( !is_same_binning )
+    throw std::runtime_error( "HistoStore " + name_ + ": cannot add histogram with different binning" );
+  for( int bin=0; bin<histo->GetNcells(); ++bin ){
+    auto content = static_cast<float>( histo->GetBinContent(bin) );
+    if( content != 0.0f )
+      AddBinContent(bin, content);
+  }
+  entries_+=histo->GetEntries();
+  std::array<double, 11> stats{};
+  histo->GetStats(stats.data());
+  for( size_t i=0; i<stats_.size(); ++i )
+    stats_[i]+=stats[i];
+}
+
+TH1* HistoStore::ToHisto() const {
+  TH1* histo;
+  const auto& x = axes_[0];
+  const auto& y = axes_[1];
+  if( axes_.size() == 2 )
+    histo = new TH2F( name_.c_str(), title_.c_str(), x.n_bins, x.min, x.max, y.n_bins, y.min, y.max );
+  else {
+    const auto& z = axes_[2];
+    histo = new TH3F( name_.c_str(), title_.c_str(), x.n_bins, x.min, x.max, y.n_bins, y.min, y.max, z.n_bins, z.min, z.max );
+  }
+  histo->SetDirectory(nullptr);
+  if( storage_ == STORAGE::SPARSE )
+    sparse_bins_.ForEach( [histo](int32_t bin, float value){ histo->SetBinContent(bin, value); } );
+  else
+    for( size_t bin=0; bin<dense_bins_.size(); ++bin )
+      if( dense_bins_[bin] != 0.0f )
+        histo->SetBinContent(bin, dense_bins_[bin]);
+  // SetBinContent resets the statistics, they are restored afterwards
+  auto stats = stats_;
+  histo->PutStats(stats.data());
+  histo->SetEntries(entries_);
+  return histo;
+}
+
+size_t HistoStore::GetMemoryUsage() const {
+  if( storage_ == STORAGE::SPARSE )
+    return sparse_bins_.GetMemoryUsage();
+  return dense_bins_.capacity()*sizeof(float);
+}
+
+void HistoStore::SparseBins::Add(int32_t bin, float value) {
+  if( (n_filled_+1)*10 > slots_.size()*7 ) // keeps load factor below 0.7
+    Grow();
+  auto mask = slots_.size()-1;
+  auto position = Position(bin);
+  while( slots_[position].bin != kEmpty && slots_[position].bin != bin )
+    position = (position+1) & mask;
+  if( slots_[position].bin == kEmpty ){
+    slots_[position].bin = bin;
+    n_filled_++;
+  }
+  slots_[position].value+=value;
+}
+
+void HistoStore::SparseBins::Grow() {
+  std::vector<Slot> old_slots( slots_.empty() ? 64 : slots_.size()*2 );
+  old_slots.swap(slots_);
+  auto mask = slots_.size()-1;
+  for( const auto& slot : old_slots ){
+    if( slot.bin == kEmpty )
+      continue;
+    auto position = Position(slot.bin);
+    while( slots_[position].bin != kEmpty )
+      position = (position+1) & mask;
+    slots_[position] = slot;
+  }
+}
+
+} // namespace AnalysisTree
@@ -0,0 +1,92 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_HISTO_STORE_H_
+#define HADES_CONTAMINATIONS_SRC_HISTO_STORE_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <TH2F.h>
+#include <TH3F.h>
+
+namespace AnalysisTree {
+
+struct Axis{
+  std::string name;
+  std::string title;
+  int n_bins;
+  double min;
+  double max;
+  // same convention as TAxis::FindBin for fixed bins: 0 is underflow and n_bins+1 is overflow
+  int FindBin(double x) const {
+    if( x < min )
+      return 0;
+    if( !(x < max) )
+      return n_bins+1;
+    return 1 + static_cast<int>( n_bins*(x-min)/(max-min) );
+  }
+  bool HasBinning(const TAxis* axis) const { return axis->GetNbins() == n_bins && axis->GetXmin() == min && axis->GetXmax() == max; }
+};
+
+/* 2D or 3D histogram with fixed binning, which is converted to TH2F/TH3F only at the end of the analysis.
+ * Fill() reproduces TH2F::Fill/TH3F::Fill (float bin contents, global bin numbering, statistics of
+ * in-range fills), so the converted histogram is the same as if ROOT histograms were filled.
+ * The bin contents are either a dense array of all cells or an open-addressing hash of the filled cells,
+ * which keeps mostly empty matrices small. */
+class HistoStore {
+public:
+  enum class STORAGE { DENSE, SPARSE };
+  HistoStore(std::string name, std::string title, std::vector<Axis> axes, STORAGE storage);
+  void Fill(double x, double y);
+  void Fill(double x, double y, double z);
+  void Add(const HistoStore* other);
+  void AddHisto(const TH1* histo); // adds TH2F/TH3F of the same binning, e.g. converted with ToHisto() and read back
+  TH1* ToHisto() const; // TH2F or TH3F detached from any directory
+  size_t GetMemoryUsage() const; // bytes taken by bin contents
+  const std::string& GetName() const { return name_; }
+  STORAGE GetStorage() const { return storage_; }
+
+  // open-addressing hash of the filled cells with linear probing
+  class SparseBins{
+  public:
+    void Add(int32_t bin, float value);
+    template<typename Function>
+    void ForEach(Function&& function) const {
+      for( const auto& slot : slots_ )
+        if( slot.bin != kEmpty )
+          function(slot.bin, slot.value);
+    }
+    size_t GetMemoryUsage() const { return slots_.capacity()*sizeof(Slot); }
+  private:
+    static constexpr int32_t kEmpty = -1;
+    struct Slot{
+      int32_t bin{kEmpty};
+      float value{0.0f};
+    };
+    void Grow();
+    size_t Position(int32_t bin) const { return ( static_cast<uint32_t>(bin) * 2654435769u ) & (slots_.size()-1); }
+    std::vector<Slot> slots_;
+    size_t n_filled_{0};
+  };
+
+private:
+  void AddBinContent(int32_t bin, float value);
+
+  std::string name_;
+  std::string title_;
+  std::vector<Axis> axes_;
+  STORAGE storage_;
+  std::vector<float> dense_bins_; // allocated with the first fill
+  SparseBins sparse_bins_;
+  size_t n_cells_{1};
+  double entries_{0.0};
+  // statistics in the order of TH1::GetStats: sumw, sumw2, sumwx, sumwx2, sumwy, sumwy2, sumwxy, sumwz, sumwz2, sumwxz, sumwyz
+  std::array<double, 11> stats_{};
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_HISTO_STORE_H_
@@ -0,0 +1,212 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "output_merger.h"
+
+#include "bootstrap_profile.h"
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TROOT.h>
+
+namespace AnalysisTree {
+
+void OutputMerger::Merge() {
+  if( input_files_.empty() )
+    throw std::runtime_error( "OutputMerger: no input files" );
+  // merged histograms must not be registered in the directories of the input files
+  ROOT::EnableThreadSafety();
+  TH1::AddDirectory(kFALSE);
+
+  auto n_groups = std::min( static_cast<size_t>(n_threads_), input_files_.size() );
+  std::vector<HistoSet> partial_sums(n_groups);
+  partial_sums.front() = ReadReference(input_files_.front());
+  auto run_parallel = [](size_t n_jobs, const std::function<void(size_t)>& job){
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(n_jobs);
+    for( size_t i=0; i<n_jobs; ++i )
+      threads.emplace_back( [i, &job, &errors](){
+        try {
+          job(i);
+        } catch (...) {
+          errors.at(i) = std::current_exception();
+        }
+      } );
+    for( auto& thread : threads )
+      thread.join();
+    for( auto& error : errors )
+      if( error )
+        std::rethrow_exception(error);
+  };
+  // contiguous groups of inputs, each summed by its own thread
+  run_parallel( n_groups, [this, n_groups, &partial_sums](size_t group){
+    auto first = input_files_.size()*group/n_groups;
+    auto last = input_files_.size()*(group+1)/n_groups;
+    for( auto i=first; i<last; ++i ){
+      if( i == 0 )
+        continue; // the reference is already read
+      auto histos = ReadFile(input_files_[i]);
+      if( partial_sums[group].empty() )
+        partial_sums[group] = std::move(histos);
+      else
+        Add(partial_sums[group], histos);
+    }
+  } );
+  // pairwise reduction of the partial sums
+  for( size_t stride=1; stride<n_groups; stride*=2 ){
+    auto n_pairs = (n_groups + 2*stride - 1) / (2*stride);
+    run_parallel( n_pairs, [stride, n_groups, &partial_sums](size_t pair){
+      auto left = 2*stride*pair;
+      auto right = left+stride;
+      if( right >= n_groups )
+        return;
+      Add(partial_sums[left], partial_sums[right]);
+      partial_sums[right].clear();
+    } );
+  }
+
+  UpdateBootstrapEstimates(partial_sums.front());
+
+  std::unique_ptr<TFile> out_file( TFile::Open(output_file_.c_str(), "recreate") );
+  if( !out_file )
+    throw std::runtime_error( "OutputMerger: cannot create " + output_file_ );
+  out_file->cd();
+  for( const auto& object : partial_sums.front() )
+    object->Write();
+  out_file->Close();
+  std::cout << "OutputMerger: " << input_files_.size() << " files with " << names_.size()
+            << " objects merged into " << output_file_ << " in " << n_groups << " threads" << std::endl;
+}
+
+OutputMerger::HistoSet OutputMerger::ReadReference(const std::string &file_name) {
+  std::unique_ptr<TFile> file( TFile::Open(file_name.c_str(), "read") );
+  if( !file )
+    throw std::runtime_error( "OutputMerger: cannot open " + file_name );
+  HistoSet histos;
+  std::set<std::string> names;
+  TIter next(file->GetListOfKeys());
+  while( auto key = static_cast<TKey*>(next()) ){
+    if( !names.insert(key->GetName()).second )
+      continue; // older cycle of the same object
+    std::unique_ptr<TObject> object( key->ReadObj() );
+    if( !dynamic_cast<TH1*>(object.get()) && !IsParameter(object.get()) )
+      throw std::runtime_error( "OutputMerger: " + std::string(key->GetName()) + " in " + file_name + " is neither a histogram nor a tag" );
+    names_.emplace_back(key->GetName());
+    histos.push_back( std::move(object) );
+  }
+  file->Close();
+  if( histos.empty() )
+    throw std::runtime_error( "OutputMerger: no histograms in " + file_name );
+  return histos;
+}
+
+OutputMerger::HistoSet OutputMerger::ReadFile(const std::string &file_name) const {
+  std::unique_ptr<TFile> file( TFile::Open(file_name.c_str(), "read") );
+  if( !file )
+    throw std::runtime_error( "OutputMerger: cannot open " + file_name );
+  std::set<std::string> names;
+  TIter next(file->GetListOfKeys());
+  while( auto key = static_cast<TKey*>(next()) )
+    names.insert(key->GetName());
+  if( names.size() != names_.size() )
+    throw std::runtime_error( "OutputMerger: " + file_name + " has " + std::to_string(names.size()) +
+                              " objects instead of " + std::to_string(names_.size()) );
+  HistoSet histos;
+  for( const auto& name : names_ ){
+    TObject* object{nullptr};
+    file->GetObject(name.c_str(), object);
+    if( !object )
+      throw std::runtime_error( "OutputMerger: " + name + " is missing in " + file_name );
+    histos.emplace_back(object);
+  }
+  file->Close();
+  return histos;
+}
+
+void OutputMerger::Add(HistoSet &result, const HistoSet &other) {
+  for( size_t i=0; i<result.size(); ++i ){
+    if( AddParameter<double>(result[i].get(), other[i].get()) || AddParameter<int>(result[i].get(), other[i].get()) )
+      continue;
+    auto histo = static_cast<TH1*>(result[i].get());
+    auto other_histo = dynamic_cast<const TH1*>(other[i].get());
+    if( !other_histo )
+      throw std::runtime_error( "OutputMerger: " + std::string(histo->GetName()) + " has different types in the inputs" );
+    CheckBinning(histo, other_histo, histo->GetName());
+    histo->Add(other_histo);
+  }
+}
+
+template<typename T>
+bool OutputMerger::AddParameter(TObject *result, const TObject *other) {
+  auto parameter = dynamic_cast<TParameter<T>*>(result);
+  if( !parameter )
+    return false;
+  auto other_parameter = dynamic_cast<const TParameter<T>*>(other);
+  if( !other_parameter )
+    throw std::runtime_error( "OutputMerger: " + std::string(parameter->GetName()) + " has different types in the inputs" );
+  if( !parameter->TestBit(TParameter<T>::kFirst) ){
+    parameter->SetVal( parameter->GetVal() + other_parameter->GetVal() );
+    return true;
+  }
+  if( parameter->GetVal() != other_parameter->GetVal() )
+    throw std::runtime_error( "OutputMerger: " + std::string(parameter->GetName()) + " differs in the inputs: " +
+                              std::to_string(parameter->GetVal()) + " and " + std::to_string(other_parameter->GetVal()) );
+  return true;
+}
+
+bool OutputMerger::IsParameter(const TObject *object) {
+  return dynamic_cast<const TParameter<double>*>(object) || dynamic_cast<const TParameter<int>*>(object);
+}
+
+void OutputMerger::UpdateBootstrapEstimates(HistoSet &histos) const {
+  auto find = [this](const std::string& name){
+    auto position = std::find(names_.begin(), names_.end(), name);
+    if( position == names_.end() )
+      throw std::runtime_error( "OutputMerger: " + name + " is missing in the inputs" );
+    return static_cast<size_t>( position-names_.begin() );
+  };
+  std::string suffix = BootstrapProfile::kEstimateSuffix;
+  auto is_bootstrap = std::any_of( names_.begin(), names_.end(), [&suffix](const std::string& name){
+    return name.size() > suffix.size() && name.compare(name.size()-suffix.size(), suffix.size(), suffix) == 0;
+  } );
+  if( !is_bootstrap )
+    return;
+  // the same in all the inputs, checked when the tags are added
+  auto mode = BootstrapProfile::GetMode( histos[ find(BootstrapProfile::kModeTagName) ].get() );
+  for( size_t i=0; i<names_.size(); ++i ){
+    const auto& name = names_[i];
+    if( name.size() <= suffix.size() || name.compare(name.size()-suffix.size(), suffix.size(), suffix) != 0 )
+      continue;
+    auto base = name.substr(0, name.size()-suffix.size());
+    auto sum_w = dynamic_cast<const TH1*>( histos[ find(base + BootstrapProfile::kSumWSuffix) ].get() );
+    auto sum_wy = dynamic_cast<const TH1*>( histos[ find(base + BootstrapProfile::kSumWYSuffix) ].get() );
+    if( !sum_w || !sum_wy )
+      throw std::runtime_error( "OutputMerger: replica sums of " + name + " are not histograms" );
+    histos[i].reset( BootstrapProfile::MakeEstimate(sum_w, sum_wy, mode) );
+  }
+}
+
+void OutputMerger::CheckBinning(const TH1 *reference, const TH1 *histo, const std::string &name) {
+  if( std::string(reference->ClassName()) != histo->ClassName() || reference->GetDimension() != histo->GetDimension() )
+    throw std::runtime_error( "OutputMerger: " + name + " has different types in the inputs" );
+  const TAxis* reference_axes[] = { reference->GetXaxis(), reference->GetYaxis(), reference->GetZaxis() };
+  const TAxis* axes[] = { histo->GetXaxis(), histo->GetYaxis(), histo->GetZaxis() };
+  for( int i=0; i<reference->GetDimension(); ++i )
+    if( reference_axes[i]->GetNbins() != axes[i]->GetNbins() ||
+        reference_axes[i]->GetXmin() != axes[i]->GetXmin() ||
+        reference_axes[i]->GetXmax() != axes[i]->GetXmax() )
+      throw std::runtime_error( "OutputMerger: " + name + " has different binning in the inputs" );
+}
+
+} // namespace AnalysisTree
@@ -0,0 +1,50 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_OUTPUT_MERGER_H_
+#define HADES_CONTAMINATIONS_SRC_OUTPUT_MERGER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <TH1.h>
+#include <TParameter.h>
+
+namespace AnalysisTree {
+
+/* Merges the output files of several jobs (the histograms written by AnalysisTask::Finish) into one file.
+ * The inputs are split into contiguous groups, one per thread. A thread reads its files one by one and adds them
+ * to its partial sum, so at most one input per thread is in memory. The partial sums are then added pairwise
+ * in parallel (tree reduction). The order of additions depends only on the order of inputs and the number of threads.
+ * The first input defines the set of histograms: every other input must have the same histograms with the same binning.
+ * Bootstrap estimates are not additive: they are derived again from the merged replica sums.
+ * Besides histograms the files may have TParameter<double> and TParameter<int> tags: those with the 'f' merge mode
+ * (e.g. the prescale or the bootstrap mode) must be equal in all the inputs, the others are summed. */
+class OutputMerger {
+public:
+  OutputMerger(std::vector<std::string> input_files, std::string output_file) :
+      input_files_(std::move(input_files)), output_file_(std::move(output_file)) {}
+  void SetNThreads(int n_threads) { n_threads_ = n_threads > 0 ? n_threads : 1; }
+  void Merge();
+private:
+  using HistoSet = std::vector<std::unique_ptr<TObject>>; // histograms and tags in the order of names_
+  HistoSet ReadReference(const std::string& file_name);
+  HistoSet ReadFile(const std::string& file_name) const;
+  static void Add(HistoSet& result, const HistoSet& other);
+  static void CheckBinning(const TH1* reference, const TH1* histo, const std::string& name);
+  // returns false if the result is not a TParameter<T>
+  template<typename T>
+  static bool AddParameter(TObject* result, const TObject* other);
+  static bool IsParameter(const TObject* object);
+  void UpdateBootstrapEstimates(HistoSet& histos) const;
+
+  std::vector<std::string> input_files_;
+  std::string output_file_;
+  int n_threads_{1};
+  std::vector<std::string> names_; // objects of the first input in the order they were written
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_OUTPUT_MERGER_H_
@@ -0,0 +1,83 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "quantile_sketch.h"
+
+#include <limits>
+#include <stdexcept>
+
+namespace AnalysisTree {
+
+QuantileSketch::QuantileSketch(double relative_accuracy, size_t max_buckets) :
+    gamma_( (1.0+relative_accuracy)/(1.0-relative_accuracy) ), inverse_log_gamma_( 1.0/std::log(gamma_) ),
+    max_buckets_(max_buckets) {
+  if( !(relative_accuracy > 0.0 && relative_accuracy < 1.0) || max_buckets < 2 )
+    throw std::runtime_error( "QuantileSketch: relative accuracy must be in (0, 1) and at least 2 buckets are needed" );
+}
+
+void QuantileSketch::Store::Add(int32_t index, uint64_t n, size_t max_buckets) {
+  if( counts.empty() ){
+    offset = index;
+    counts.push_back(n);
+    return;
+  }
+  if( index < offset ){
+    // below the collapsed range the value goes to the lowest bucket
+    if( counts.size() + static_cast<size_t>(offset-index) > max_buckets ){
+      counts.front()+=n;
+      return;
+    }
+    counts.insert( counts.begin(), static_cast<size_t>(offset-index), 0 );
+    offset = index;
+  } else if( static_cast<size_t>(index-offset) >= counts.size() )
+    counts.resize( static_cast<size_t>(index-offset)+1, 0 );
+  counts[index-offset]+=n;
+  if( counts.size() <= max_buckets )
+    return;
+  // the smallest magnitudes are collapsed into one bucket
+  auto n_collapsed = counts.size()-max_buckets+1;
+  uint64_t collapsed{0};
+  for( size_t i=0; i<n_collapsed; ++i )
+    collapsed+=counts[i];
+  counts.erase( counts.begin(), counts.begin()+static_cast<long>(n_collapsed)-1 );
+  counts.front() = collapsed;
+  offset+=static_cast<int32_t>(n_collapsed)-1;
+}
+
+void QuantileSketch::Merge(const QuantileSketch &other) {
+  if( other.gamma_ != gamma_ )
+    throw std::runtime_error( "QuantileSketch: cannot merge sketches of different accuracy" );
+  for( size_t i=0; i<other.positive_.counts.size(); ++i )
+    if( other.positive_.counts[i] > 0 )
+      positive_.Add( other.positive_.offset+static_cast<int32_t>(i), other.positive_.counts[i], max_buckets_ );
+  for( size_t i=0; i<other.negative_.counts.size(); ++i )
+    if( other.negative_.counts[i] > 0 )
+      negative_.Add( other.negative_.offset+static_cast<int32_t>(i), other.negative_.counts[i], max_buckets_ );
+  zero_count_+=other.zero_count_;
+  count_+=other.count_;
+}
+
+double QuantileSketch::GetQuantile(double q) const {
+  if( count_ == 0 )
+    return std::numeric_limits<double>::quiet_NaN();
+  auto rank = static_cast<uint64_t>( q*static_cast<double>(count_-1) );
+  uint64_t n{0};
+  // from the most negative to the most positive value
+  for( auto i=negative_.counts.size(); i-- > 0; ){
+    n+=negative_.counts[i];
+    if( n > rank )
+      return -GetValue( negative_.offset+static_cast<int32_t>(i) );
+  }
+  n+=zero_count_;
+  if( n > rank )
+    return 0.0;
+  for( size_t i=0; i<positive_.counts.size(); ++i ){
+    n+=positive_.counts[i];
+    if( n > rank )
+      return GetValue( positive_.offset+static_cast<int32_t>(i) );
+  }
+  return GetValue( positive_.offset+static_cast<int32_t>(positive_.counts.size())-1 );
+}
+
+} // namespace AnalysisTree
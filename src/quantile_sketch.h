@@ -0,0 +1,60 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_QUANTILE_SKETCH_H_
+#define HADES_CONTAMINATIONS_SRC_QUANTILE_SKETCH_H_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace AnalysisTree {
+
+/* Streaming quantile sketch with relative accuracy (DDSketch): values are counted in logarithmic buckets
+ * [gamma^(k-1), gamma^k) of their magnitude, separately for positive and negative values, with
+ * gamma = (1+a)/(1-a) for the relative accuracy a. A quantile is the middle of the bucket holding its rank,
+ * so it is within a*|value| of the exact one. Sketches of the same accuracy are merged by adding the counts.
+ * The memory is bounded by max_buckets per sign: beyond it the buckets of the smallest magnitudes are collapsed,
+ * which loses the accuracy only near zero. Values below 1e-9 in magnitude are counted as zero. */
+class QuantileSketch {
+public:
+  explicit QuantileSketch(double relative_accuracy = 0.01, size_t max_buckets = 2048);
+  void Add(double x) {
+    if( !std::isfinite(x) )
+      return;
+    count_++;
+    if( std::fabs(x) < kMinMagnitude )
+      zero_count_++;
+    else if( x > 0 )
+      positive_.Add( GetIndex(x), 1, max_buckets_ );
+    else
+      negative_.Add( GetIndex(-x), 1, max_buckets_ );
+  }
+  void Merge(const QuantileSketch& other);
+  double GetQuantile(double q) const; // NaN if the sketch is empty
+  uint64_t GetCount() const { return count_; }
+  size_t GetMemoryUsage() const { return (positive_.counts.capacity()+negative_.counts.capacity())*sizeof(uint64_t); }
+
+private:
+  static constexpr double kMinMagnitude = 1e-9;
+  // counts of contiguous bucket indices starting with offset
+  struct Store{
+    int32_t offset{0};
+    std::vector<uint64_t> counts;
+    void Add(int32_t index, uint64_t n, size_t max_buckets);
+  };
+  int32_t GetIndex(double magnitude) const { return static_cast<int32_t>( std::ceil( std::log(magnitude)*inverse_log_gamma_ ) ); }
+  double GetValue(int32_t index) const { return 2.0*std::pow(gamma_, index)/(gamma_+1.0); }
+
+  double gamma_;
+  double inverse_log_gamma_;
+  size_t max_buckets_;
+  Store positive_;
+  Store negative_; // by magnitude
+  uint64_t zero_count_{0};
+  uint64_t count_{0};
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_QUANTILE_SKETCH_H_
@@ -0,0 +1,65 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "stage_stats.h"
+
+#include <fstream>
+#include <stdexcept>
+
+#include <TFile.h>
+
+namespace AnalysisTree {
+
+const char *StageStats::GetStageName(int stage) {
+  static constexpr std::array<const char*, N_STAGES> names{
+      "read_header", "event_cuts", "read_payload", "track_loop", "protons", "wall_loop", "fill" };
+  return names.at(stage);
+}
+
+void StageStats::Add(const StageStats &other) {
+  for( int i=0; i<N_STAGES; ++i ){
+    stages_[i].count+=other.stages_[i].count;
+    stages_[i].total_ns+=other.stages_[i].total_ns;
+    for( int b=0; b<kNBuckets; ++b )
+      stages_[i].histogram[b]+=other.stages_[i].histogram[b];
+  }
+  Increment(n_events_read, other.n_events_read.load());
+  Increment(n_events_selected, other.n_events_selected.load());
+  Increment(n_tracks, other.n_tracks.load());
+}
+
+void StageStats::WriteSummary(const std::string &file_name, double wall_time_s, int n_threads) const {
+  std::ofstream out(file_name);
+  if( !out )
+    throw std::runtime_error( "Cannot write timing summary " + file_name );
+  uint64_t io_ns{0};
+  uint64_t cpu_ns{0};
+  for( int i=0; i<N_STAGES; ++i )
+    ( i == READ_HEADER || i == READ_PAYLOAD ? io_ns : cpu_ns )+=stages_[i].total_ns;
+  out << "{\n";
+  out << "  \"threads\": " << n_threads << ",\n";
+  out << "  \"wall_time_s\": " << wall_time_s << ",\n";
+  out << "  \"events_read\": " << n_events_read.load() << ",\n";
+  out << "  \"events_selected\": " << n_events_selected.load() << ",\n";
+  out << "  \"tracks\": " << n_tracks.load() << ",\n";
+  out << "  \"events_per_s\": " << (wall_time_s > 0 ? n_events_read.load()/wall_time_s : 0.0) << ",\n";
+  out << "  \"tracks_per_s\": " << (wall_time_s > 0 ? n_tracks.load()/wall_time_s : 0.0) << ",\n";
+  out << "  \"file_bytes_read\": " << TFile::GetFileBytesRead() << ",\n";
+  out << "  \"read_fraction\": " << ( io_ns+cpu_ns > 0 ? double(io_ns)/double(io_ns+cpu_ns) : 0.0 ) << ",\n";
+  out << "  \"stages\": {\n";
+  for( int i=0; i<N_STAGES; ++i ){
+    const auto& stage = stages_[i];
+    out << "    \"" << GetStageName(i) << "\": {\"count\": " << stage.count
+        << ", \"total_s\": " << stage.total_ns*1e-9
+        << ", \"mean_us\": " << ( stage.count > 0 ? stage.total_ns*1e-3/stage.count : 0.0 )
+        << ", \"log2_ns_histogram\": [";
+    for( int b=0; b<kNBuckets; ++b )
+      out << (b > 0 ? ", " : "") << stage.histogram[b];
+    out << "]}" << (i+1 < N_STAGES ? "," : "") << "\n";
+  }
+  out << "  }\n";
+  out << "}\n";
+}
+
+} // namespace AnalysisTree
@@ -0,0 +1,80 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_STAGE_STATS_H_
+#define HADES_CONTAMINATIONS_SRC_STAGE_STATS_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace AnalysisTree {
+
+/* Per-thread timing of the event loop stages and throughput counters.
+ * Time is measured in laps: STAGE_START marks the beginning of an event, every STAGE_LAP attributes
+ * the time since the previous mark to the given stage. The counters have one writer (the owning thread)
+ * and are read by the progress monitor, hence relaxed atomics without read-modify-write.
+ * The macros expand to nothing unless the project is configured with -DINSTRUMENTATION=ON. */
+class StageStats {
+public:
+  enum STAGES {
+    READ_HEADER,  // reading and decompressing the event header
+    EVENT_CUTS,   // evaluation of the event cuts
+    READ_PAYLOAD, // reading and decompressing track and wall branches
+    TRACK_LOOP,   // columnar kinematics and event sums
+    PROTONS,      // proton selection and efficiency lookup
+    WALL_LOOP,    // forward wall ring sums
+    FILL,         // histogram fills
+    N_STAGES
+  };
+  static constexpr int kNBuckets = 40; // log2 buckets of the stage duration in ns
+  struct Stage{
+    uint64_t count{0};
+    uint64_t total_ns{0};
+    std::array<uint64_t, kNBuckets> histogram{};
+  };
+  using Clock = std::chrono::steady_clock;
+
+  static const char* GetStageName(int stage);
+  void Start() { last_ = Clock::now(); }
+  void Lap(STAGES stage) {
+    auto now = Clock::now();
+    auto ns = static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>(now-last_).count() );
+    auto& s = stages_[stage];
+    s.count++;
+    s.total_ns+=ns;
+    s.histogram[ ns == 0 ? 0 : std::min(kNBuckets-1, 64-__builtin_clzll(ns)) ]++;
+    last_ = now;
+  }
+  static void Increment(std::atomic<uint64_t>& counter, uint64_t n=1) {
+    counter.store( counter.load(std::memory_order_relaxed)+n, std::memory_order_relaxed );
+  }
+  void Add(const StageStats& other);
+  // writes the summary as JSON, wall_time_s is the elapsed time of the whole event loop
+  void WriteSummary(const std::string& file_name, double wall_time_s, int n_threads) const;
+
+  std::atomic<uint64_t> n_events_read{0};
+  std::atomic<uint64_t> n_events_selected{0};
+  std::atomic<uint64_t> n_tracks{0};
+private:
+  std::array<Stage, N_STAGES> stages_{};
+  Clock::time_point last_{};
+};
+
+} // namespace AnalysisTree
+
+#ifdef HADES_INSTRUMENTATION
+#define STAGE_START(stats) do{ if(stats) (stats)->Start(); }while(0)
+#define STAGE_LAP(stats, stage) do{ if(stats) (stats)->Lap(::AnalysisTree::StageStats::stage); }while(0)
+#define STAGE_COUNT(stats, counter, n) do{ if(stats) ::AnalysisTree::StageStats::Increment((stats)->counter, n); }while(0)
+#else
+#define STAGE_START(stats) do{}while(0)
+#define STAGE_LAP(stats, stage) do{}while(0)
+#define STAGE_COUNT(stats, counter, n) do{}while(0)
+#endif
+
+#endif // HADES_CONTAMINATIONS_SRC_STAGE_STATS_H_
@@ -0,0 +1,719 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "task_runner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <TFile.h>
+#include <TObjString.h>
+#include <TParameter.h>
+#include <TROOT.h>
+#include <TTreeCacheUnzip.h>
+#include <TUUID.h>
+
+#include "file_prefetcher.h"
+
+namespace AnalysisTree {
+
+namespace {
+// FNV-1a of the file name without the directory, so the same file is sampled the same way from any location
+uint64_t HashFileName(const std::string& file_name){
+  auto slash = file_name.rfind('/');
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for( auto i = slash == std::string::npos ? 0 : slash+1; i<file_name.size(); ++i ){
+    hash^=static_cast<unsigned char>(file_name[i]);
+    hash*=0x100000001b3ull;
+  }
+  return hash;
+}
+// the entry is taken if its SplitMix64 hash, as a uniform number in [0, 1), is below the fraction
+bool IsSampled(uint64_t file_key, long long local_entry, double fraction){
+  auto x = file_key + static_cast<uint64_t>(local_entry)*0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  x = x ^ (x >> 31);
+  return static_cast<double>(x >> 11) * 0x1.0p-53 < fraction;
+}
+// resident and peak resident memory of the process in MB, 0 where /proc is not available
+std::pair<double, double> GetResidentMemory(){
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  double resident{0.0};
+  double peak{0.0};
+  while( std::getline(status, line) ){
+    std::istringstream fields(line);
+    std::string name;
+    double kb{0.0};
+    fields >> name >> kb;
+    if( name == "VmRSS:" )
+      resident = kb/1024;
+    else if( name == "VmHWM:" )
+      peak = kb/1024;
+  }
+  return {resident, peak};
+}
+} // namespace
+
+TaskRunner::~TaskRunner() {
+  for( auto& worker : workers_ ){
+    for( auto task : worker->tasks )
+      delete task;
+    // the chain refers to the branch objects, it goes first
+    delete worker->chain;
+    delete worker->event_header;
+    for( auto particles : worker->particles )
+      delete particles;
+    for( auto tracks : worker->tracks )
+      delete tracks;
+    for( auto hits : worker->hits )
+      delete hits;
+    for( auto modules : worker->modules )
+      delete modules;
+  }
+}
+
+bool TaskRunner::Worker::LoadEventHeader(long long entry, long long& local_entry) {
+  local_entry = chain->LoadTree(entry);
+  if( local_entry < 0 )
+    return false;
+  if( chain->GetTreeNumber() != tree_number ){
+    // the chain switched to the next file, branch pointers have to be updated
+    tree_number = chain->GetTreeNumber();
+    auto tree = chain->GetTree();
+    event_header_branch = tree->GetBranch("event_header");
+    SplitHeaderBranch();
+    payload_branches.clear();
+    for( const auto& name : payload_branch_names )
+      payload_branches.push_back( tree->GetBranch(name.c_str()) );
+  }
+  if( header_branches.empty() )
+    event_header_branch->GetEntry(local_entry);
+  for( auto branch : header_branches )
+    branch->GetEntry(local_entry);
+  return true;
+}
+
+void TaskRunner::Worker::LoadPayload(long long local_entry) {
+  for( auto branch : header_rest_branches )
+    branch->GetEntry(local_entry);
+  for( auto branch : payload_branches )
+    branch->GetEntry(local_entry);
+}
+
+void TaskRunner::Worker::SplitHeaderBranch() {
+  header_branches.clear();
+  header_rest_branches.clear();
+  if( header_columns.empty() )
+    return;
+  auto sub_branches = event_header_branch->GetListOfBranches();
+  if( !sub_branches )
+    return; // the event header is not split, it is read as a whole
+  for( int i=0; i<sub_branches->GetEntriesFast(); ++i ){
+    auto branch = static_cast<TBranch*>( sub_branches->At(i) );
+    std::string name = branch->GetName();
+    auto is_column = std::any_of( header_columns.begin(), header_columns.end(), [&name](const std::string& column){
+      auto suffix = "." + column;
+      return name == column || ( name.size() > suffix.size() && name.compare(name.size()-suffix.size(), suffix.size(), suffix) == 0 );
+    } );
+    (is_column ? header_branches : header_rest_branches).push_back(branch);
+  }
+  if( header_branches.empty() )
+    header_rest_branches.clear();
+}
+
+void TaskRunner::Init() {
+  if( variants_.empty() )
+    throw std::runtime_error( "TaskRunner: no analysis variants are added" );
+  if( !checkpoint_file_.empty() && !event_cache_file_.empty() )
+    throw std::runtime_error( "TaskRunner: event cache cannot be written together with checkpoints" );
+  for( const auto& variant : variants_ )
+    if( !variant.task_factory )
+      throw std::runtime_error( "TaskRunner: task factory of variant " + variant.name + " is not set" );
+  // histograms of different threads have the same names, they must not be registered in gDirectory
+  ROOT::EnableThreadSafety();
+  TH1::AddDirectory(kFALSE);
+  if( n_unzip_threads_ > 0 ){
+    // the baskets in the tree caches are decompressed by the tasks of the implicit multithreading pool
+    ROOT::EnableImplicitMT(n_unzip_threads_);
+    TTreeCacheUnzip::SetParallelUnzip(TTreeCacheUnzip::kEnable);
+  }
+
+  std::ifstream list(file_list_);
+  if( !list )
+    throw std::runtime_error( "TaskRunner: cannot open file list " + file_list_ );
+  std::string line;
+  while( std::getline(list, line) ){
+    if( line.empty() )
+      continue;
+    file_names_.push_back(line);
+  }
+  if( file_names_.empty() )
+    throw std::runtime_error( "TaskRunner: file list " + file_list_ + " is empty" );
+  if( !(prescale_ > 0.0 && prescale_ <= 1.0) )
+    throw std::runtime_error( "TaskRunner: prescale must be in (0, 1]" );
+  for( const auto& file_name : file_names_ )
+    file_keys_.push_back( HashFileName(file_name) );
+
+  std::unique_ptr<TFile> first_file( TFile::Open(file_names_.front().c_str(), "read") );
+  if( !first_file )
+    throw std::runtime_error( "TaskRunner: cannot open " + file_names_.front() );
+  Configuration* config{nullptr};
+  first_file->GetObject("Configuration", config);
+  config_.reset(config);
+  if( !config_ )
+    throw std::runtime_error( "TaskRunner: no Configuration in " + file_names_.front() );
+  first_file->Close();
+  std::set<std::string> header_columns;
+  for( auto& variant : variants_ ){
+    variant.event_selection.Init(*config_);
+    for( const auto& column : variant.event_selection.GetColumns() )
+      header_columns.insert(column);
+  }
+
+  for( int i=0; i<n_threads_; ++i ){
+    workers_.emplace_back( std::make_unique<Worker>() );
+    auto& worker = *workers_.back();
+    worker.chain = MakeChain();
+    BindBranches(worker);
+    // the cache is created for the current file and moves with the chain to the next files
+    worker.chain->LoadTree(0);
+    if( tree_cache_size_ > 0 )
+      worker.chain->SetCacheSize(tree_cache_size_);
+    // the cache prefetches the baskets of the given branches only, the learning phase is not needed.
+    // By default only the event header is cached: the payload baskets are read when a selected event needs them
+    for( const auto& name : AnalysisTask::GetRequiredBranches() )
+      if( name == "event_header" || is_cache_payload_ )
+        worker.chain->AddBranchToCache( (name+"*").c_str(), true );
+    worker.chain->StopCacheLearningPhase();
+    worker.is_selected.assign(variants_.size(), 0);
+    if( is_early_header_columns_ )
+      worker.header_columns.assign(header_columns.begin(), header_columns.end());
+    // sized once, the tasks keep the addresses of the streams
+    worker.streams.resize(variants_.size());
+    for( size_t v=0; v<variants_.size(); ++v ){
+      worker.event_selections.push_back(variants_[v].event_selection);
+      auto task = variants_[v].task_factory();
+      worker.tasks.push_back(task);
+      task->SetInConfiguration(config_.get());
+      task->SetEventStream(&worker.streams[v]);
+      task->Init(worker.branch_map);
+#ifdef HADES_INSTRUMENTATION
+      task->SetStageStats(&worker.stage_stats);
+#endif
+    }
+  }
+  for( const auto& variant : variants_ ){
+    results_.emplace_back( variant.task_factory() );
+    results_.back()->InitHistograms();
+    if( !event_cache_file_.empty() ){
+      // one cache with the events in the order they are filled
+      auto cache_name = event_cache_file_ + ( variants_.size() > 1 ? "." + variant.name : "" );
+      event_caches_.push_back( std::make_shared<EventCacheWriter>(cache_name + ".0") );
+      results_.back()->SetEventCache(event_caches_.back());
+    }
+  }
+  n_entries_ = workers_.front()->chain->GetEntries();
+  if( is_event_index_ )
+    InitEventIndex();
+}
+
+void TaskRunner::InitEventIndex() {
+  index_checks_.clear();
+  for( const auto& variant : variants_ ){
+    std::vector<IndexCheck> checks;
+    for( const auto& cut : variant.event_selection.GetCuts() ){
+      auto field = EventIndex::FindField(cut.field);
+      if( field != EventIndex::N_FIELDS )
+        checks.push_back( { field, cut.min, cut.max } );
+    }
+    if( checks.empty() ){
+      // every entry may be selected by this variant
+      std::cout << "TaskRunner: variant " << variant.name << " has no cuts on the indexed fields, the event index is not used" << std::endl;
+      is_event_index_ = false;
+      return;
+    }
+    index_checks_.push_back(checks);
+  }
+  auto chain = workers_.front()->chain;
+  auto offsets = chain->GetTreeOffset();
+  size_t n_indexed{0};
+  is_file_indexed_.assign(file_names_.size(), 0);
+  for( size_t file=0; file<file_names_.size(); ++file ){
+    EventIndex index( EventIndex::GetFileName(file_names_[file], index_dir_), offsets[file+1]-offsets[file] );
+    is_file_indexed_[file] = index.IsValid();
+    n_indexed+=is_file_indexed_[file];
+  }
+  std::cout << "TaskRunner: " << n_indexed << " of " << file_names_.size() << " files have an event index" << std::endl;
+}
+
+void TaskRunner::Run(long long n_events) {
+  n_events = n_events < 0 || n_events > n_entries_ ? n_entries_ : n_events;
+  auto n_workers = static_cast<long long>(workers_.size());
+  auto unit_size = unit_size_ > 0 ? unit_size_ : std::max( 1LL, n_events / (16*n_workers) );
+  if( is_resume_ )
+    unit_size = ReadCheckpoint(n_events, unit_size);
+  n_events_ = n_events;
+  run_unit_size_ = unit_size;
+  auto units = MakeWorkUnits(n_events, unit_size);
+  if( !restored_units_.empty() ){
+    // the units processed before the checkpoint are skipped
+    std::vector<WorkUnit> remaining_units;
+    size_t n_restored{0};
+    for( const auto& unit : units ){
+      auto is_restored = std::any_of( restored_units_.begin(), restored_units_.end(), [&unit](const WorkUnit& restored){
+        return restored.first_entry == unit.first_entry && restored.last_entry == unit.last_entry;
+      } );
+      if( is_restored )
+        n_restored++;
+      else
+        remaining_units.push_back(unit);
+    }
+    if( n_restored != restored_units_.size() )
+      throw std::runtime_error( "TaskRunner: checkpoint " + checkpoint_file_ + " does not match the input" );
+    units.swap(remaining_units);
+  }
+  // positions of the units' files in the order the threads take them, for the read-ahead
+  std::vector<size_t> unit_positions(units.size());
+  std::vector<std::string> files_in_order;
+  std::map<int, size_t> file_positions;
+  for( size_t u=0; u<units.size(); ++u ){
+    auto inserted = file_positions.emplace(units[u].file, files_in_order.size());
+    if( inserted.second )
+      files_in_order.push_back( file_names_.at(units[u].file) );
+    unit_positions[u] = inserted.first->second;
+  }
+  std::unique_ptr<FilePrefetcher> prefetcher;
+  if( read_ahead_files_ > 0 )
+    prefetcher = std::make_unique<FilePrefetcher>(files_in_order, read_ahead_files_, read_ahead_budget_);
+  std::vector<char> is_done(units.size(), 0); // the unit is filled into the results
+  FillSequence fill_sequence;
+  fill_sequence.window = 2*static_cast<size_t>(n_workers);
+  auto is_checkpointing = !checkpoint_file_.empty();
+  CheckpointSync checkpoint_sync;
+  checkpoint_sync.n_running = static_cast<int>(n_workers);
+  checkpoint_sync.next_time = std::chrono::steady_clock::now() + std::chrono::seconds(checkpoint_interval_s_);
+  std::atomic<size_t> next_unit{0};
+  auto start_time = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  std::vector<std::exception_ptr> errors(workers_.size());
+  for( long long i=0; i<n_workers; ++i ){
+    threads.emplace_back( [this, i, is_checkpointing, &units, &unit_positions, &prefetcher, &is_done, &fill_sequence,
+                           &checkpoint_sync, &next_unit, &errors](){
+      auto& worker = *workers_.at(i);
+      try {
+        for( auto u = next_unit++; u < units.size(); u = next_unit++ ){
+          if( !WaitForFillWindow(fill_sequence, u) )
+            break;
+          if( prefetcher )
+            prefetcher->SetPosition(unit_positions[u]);
+          Loop(worker, units[u]);
+          // the worker's streams are emptied for the next unit, their addresses stay the same
+          FinishedUnit finished{ std::vector<AnalysisTask::EventStream>(variants_.size()), worker.n_sampled };
+          for( size_t v=0; v<variants_.size(); ++v )
+            std::swap( finished.streams[v], worker.streams[v] );
+          worker.n_sampled = 0;
+          FillInOrder(fill_sequence, u, std::move(finished), is_done);
+          if( is_checkpointing )
+            SyncCheckpoint(checkpoint_sync, units, is_done, false);
+        }
+      } catch (...) {
+        errors.at(i) = std::current_exception();
+        next_unit = units.size(); // the other threads stop after their current unit
+        AbortFill(fill_sequence);
+      }
+      if( is_checkpointing )
+        SyncCheckpoint(checkpoint_sync, units, is_done, true, errors.at(i) != nullptr);
+    } );
+  }
+#ifdef HADES_INSTRUMENTATION
+  // periodic report of the throughput while the workers are running
+  std::mutex progress_mutex;
+  std::condition_variable progress_condition;
+  bool is_finished{false};
+  std::thread progress_thread( [&](){
+    std::unique_lock<std::mutex> lock(progress_mutex);
+    while( !progress_condition.wait_for( lock, std::chrono::seconds(progress_interval_s_), [&is_finished](){ return is_finished; } ) )
+      PrintProgress( std::chrono::duration<double>(std::chrono::steady_clock::now()-start_time).count() );
+  } );
+#endif
+  for( auto& thread : threads )
+    thread.join();
+  wall_time_s_ = std::chrono::duration<double>(std::chrono::steady_clock::now()-start_time).count();
+#ifdef HADES_INSTRUMENTATION
+  {
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    is_finished = true;
+  }
+  progress_condition.notify_one();
+  progress_thread.join();
+  PrintProgress(wall_time_s_);
+#endif
+  for( auto& error : errors )
+    if( error )
+      std::rethrow_exception(error);
+  std::cout << "TaskRunner: " << n_events << " entries processed in " << n_workers << " threads, "
+            << units.size() << " work units" << std::endl;
+  if( prescale_ < 1.0 )
+    std::cout << "TaskRunner: prescale " << prescale_ << ", " << n_sampled_ << " entries of "
+              << n_events << " are read" << std::endl;
+  if( is_event_index_ ){
+    long long n_index_skipped{0};
+    long long n_stale_index_units{0};
+    for( const auto& worker : workers_ ){
+      n_index_skipped+=worker->n_index_skipped;
+      n_stale_index_units+=worker->n_stale_index_units;
+    }
+    // the skipped entries are not counted by the event selections
+    std::cout << "TaskRunner: " << n_index_skipped << " entries are skipped with the event index" << std::endl;
+    if( n_stale_index_units > 0 )
+      std::cout << "TaskRunner: " << n_stale_index_units << " work units are read fully, their files were written again "
+                << "after the index was built. Rebuild the indices with analyse index" << std::endl;
+  }
+  // all the threads' histograms, tree caches and read-ahead buffers are still allocated
+  auto memory = GetResidentMemory();
+  std::cout << "TaskRunner: resident memory " << memory.first << " MB, peak " << memory.second << " MB in "
+            << n_workers << " threads with " << variants_.size() << " variants" << std::endl;
+}
+
+std::vector<TaskRunner::WorkUnit> TaskRunner::MakeWorkUnits(long long n_events, long long unit_size) const {
+  auto chain = workers_.front()->chain;
+  auto offsets = chain->GetTreeOffset(); // first entry of each file, filled by GetEntries() in Init()
+  std::vector<WorkUnit> units;
+  for( int file=0; file<chain->GetNtrees(); ++file ){
+    auto first = std::min( offsets[file], n_events );
+    auto last = std::min( offsets[file+1], n_events );
+    if( first == last )
+      continue;
+    // large files are split into equal ranges of at most unit_size entries
+    auto n_units = (last-first + unit_size-1) / unit_size;
+    for( long long u=0; u<n_units; ++u )
+      units.push_back( { first + (last-first)*u/n_units, first + (last-first)*(u+1)/n_units, file, offsets[file],
+                         offsets[file+1]-offsets[file] } );
+  }
+  // the units are in the order of entries, which is the order they are filled in
+  return units;
+}
+
+void TaskRunner::FillInOrder(FillSequence &sequence, size_t unit, FinishedUnit finished, std::vector<char> &is_done) {
+  std::unique_lock<std::mutex> lock(sequence.mutex);
+  sequence.pending.emplace(unit, std::move(finished));
+  if( sequence.is_filling )
+    return; // the filling thread takes the unit when it gets to it
+  sequence.is_filling = true;
+  for( auto next = sequence.pending.find(sequence.next_unit); next != sequence.pending.end();
+       next = sequence.pending.find(sequence.next_unit) ){
+    auto next_unit = std::move(next->second);
+    sequence.pending.erase(next);
+    // the other threads add their units meanwhile
+    lock.unlock();
+    for( size_t v=0; v<results_.size(); ++v )
+      results_[v]->FillStream(next_unit.streams.at(v));
+    lock.lock();
+    // the counters and the results of a checkpoint stay consistent
+    n_sampled_+=next_unit.n_sampled;
+    is_done[sequence.next_unit] = 1;
+    sequence.next_unit++;
+    sequence.condition.notify_all();
+  }
+  sequence.is_filling = false;
+}
+
+bool TaskRunner::WaitForFillWindow(FillSequence &sequence, size_t unit) const {
+  std::unique_lock<std::mutex> lock(sequence.mutex);
+  // the next unit to be filled is always being processed by a thread which is not waiting here
+  sequence.condition.wait( lock, [&sequence, unit](){
+    return sequence.is_aborted || unit < sequence.next_unit+sequence.window;
+  } );
+  return !sequence.is_aborted;
+}
+
+void TaskRunner::AbortFill(FillSequence &sequence) const {
+  {
+    std::lock_guard<std::mutex> lock(sequence.mutex);
+    sequence.is_aborted = true;
+  }
+  sequence.condition.notify_all();
+}
+
+void TaskRunner::Finish() {
+  for( auto& event_cache : event_caches_ ){
+    // the replay of the cache is tagged as the output of this run
+    event_cache->SetSampling(prescale_, n_events_, n_sampled_);
+    event_cache->Close();
+  }
+#ifdef HADES_INSTRUMENTATION
+  StageStats total_stats;
+  for( auto& worker : workers_ )
+    total_stats.Add(worker->stage_stats);
+  auto summary_file_name = variants_.front().out_file_name;
+  auto extension = summary_file_name.rfind(".root");
+  if( extension != std::string::npos && extension+5 == summary_file_name.size() )
+    summary_file_name.erase(extension);
+  summary_file_name+=".timing.json";
+  total_stats.WriteSummary(summary_file_name, wall_time_s_, static_cast<int>(workers_.size()));
+  std::cout << "TaskRunner: timing summary is written to " << summary_file_name << std::endl;
+#endif
+  for( size_t v=0; v<variants_.size(); ++v ){
+    auto& variant = variants_[v];
+    for( const auto& worker : workers_ )
+      variant.event_selection.AddCounters(worker->event_selections.at(v));
+    variant.event_selection.Print();
+    auto& result = results_.at(v);
+    // the ranges of a run shorter than the auto-range buffer are decided on all its events
+    result->OfferAutoRange();
+    result->ApplyAutoRange();
+    std::cout << "TaskRunner: " << variant.name << " histograms" << std::endl;
+    result->PrintMemoryUsage();
+    auto out_file = TFile::Open(variant.out_file_name.c_str(), "recreate");
+    if( !out_file )
+      throw std::runtime_error( "TaskRunner: cannot create " + variant.out_file_name );
+    out_file->cd();
+    result->Finish();
+    if( prescale_ < 1.0 )
+      WriteSamplingTags(prescale_, n_events_, n_sampled_);
+    out_file->Close();
+  }
+  // the run is complete, it must not be resumed
+  if( !checkpoint_file_.empty() )
+    std::remove(checkpoint_file_.c_str());
+}
+
+void TaskRunner::SyncCheckpoint(CheckpointSync &sync, const std::vector<WorkUnit> &units,
+                                const std::vector<char> &is_done, bool is_leaving, bool is_failed) const {
+  std::unique_lock<std::mutex> lock(sync.mutex);
+  // the last checkpoint before the failure stays the one to resume from
+  sync.is_failed = sync.is_failed || is_failed;
+  if( is_leaving )
+    sync.n_running--;
+  else if( !sync.is_requested && std::chrono::steady_clock::now() >= sync.next_time )
+    sync.is_requested = true;
+  if( !sync.is_requested )
+    return;
+  if( !is_leaving )
+    sync.n_paused++;
+  if( sync.n_paused == sync.n_running ){
+    // the last thread reaching the boundary writes the checkpoint while the others wait
+    try {
+      if( sync.is_failed )
+        std::cerr << "TaskRunner: checkpoint is not written after a failed work unit" << std::endl;
+      else
+        WriteCheckpoint(units, is_done);
+    } catch (std::exception& e) {
+      std::cerr << "TaskRunner: checkpoint is not written: " << e.what() << std::endl;
+    }
+    sync.is_requested = false;
+    sync.n_paused = 0;
+    sync.generation++;
+    sync.next_time = std::chrono::steady_clock::now() + std::chrono::seconds(checkpoint_interval_s_);
+    sync.condition.notify_all();
+    return;
+  }
+  if( is_leaving )
+    return;
+  auto generation = sync.generation;
+  sync.condition.wait( lock, [&sync, generation](){ return sync.generation != generation; } );
+}
+
+void TaskRunner::WriteCheckpoint(const std::vector<WorkUnit> &units, const std::vector<char> &is_done) const {
+  auto temporary_file_name = checkpoint_file_ + ".tmp";
+  std::unique_ptr<TFile> file( TFile::Open(temporary_file_name.c_str(), "recreate") );
+  if( !file )
+    throw std::runtime_error( "cannot create " + temporary_file_name );
+  std::ostringstream processed_entries;
+  processed_entries << std::setprecision(17); // the prescale is read back exactly
+  processed_entries << n_entries_ << " " << n_events_ << " " << run_unit_size_ << " "
+                    << prescale_ << " " << n_sampled_ << "\n";
+  for( const auto& unit : restored_units_ )
+    processed_entries << unit.first_entry << " " << unit.last_entry << "\n";
+  for( size_t u=0; u<units.size(); ++u )
+    if( is_done[u] )
+      processed_entries << units[u].first_entry << " " << units[u].last_entry << "\n";
+  TObjString processed_entries_string( processed_entries.str().c_str() );
+  file->WriteTObject( &processed_entries_string, "processed_entries" );
+  // the results hold exactly the units marked done: the threads are paused, none of them is filling
+  for( size_t v=0; v<variants_.size(); ++v ){
+    file->mkdir(variants_[v].name.c_str())->cd();
+    results_.at(v)->Finish();
+  }
+  file->Close();
+  // the previous checkpoint is replaced only by the complete file
+  if( std::rename(temporary_file_name.c_str(), checkpoint_file_.c_str()) != 0 )
+    throw std::runtime_error( "cannot rename " + temporary_file_name + " to " + checkpoint_file_ );
+  std::cout << "TaskRunner: checkpoint is written to " << checkpoint_file_ << std::endl;
+}
+
+long long TaskRunner::ReadCheckpoint(long long n_events, long long unit_size) {
+  if( !std::ifstream(checkpoint_file_).good() ){
+    std::cout << "TaskRunner: no checkpoint " << checkpoint_file_ << ", starting from the beginning" << std::endl;
+    return unit_size;
+  }
+  std::unique_ptr<TFile> file( TFile::Open(checkpoint_file_.c_str(), "read") );
+  if( !file )
+    throw std::runtime_error( "TaskRunner: cannot open checkpoint " + checkpoint_file_ );
+  TObjString* processed_entries{nullptr};
+  file->GetObject("processed_entries", processed_entries);
+  if( !processed_entries )
+    throw std::runtime_error( "TaskRunner: " + checkpoint_file_ + " is not a checkpoint" );
+  std::istringstream in( processed_entries->GetString().Data() );
+  long long n_entries{0};
+  long long checkpoint_n_events{0};
+  double checkpoint_prescale{0.0};
+  in >> n_entries >> checkpoint_n_events >> unit_size >> checkpoint_prescale >> n_sampled_;
+  if( n_entries != n_entries_ || checkpoint_n_events != n_events )
+    throw std::runtime_error( "TaskRunner: checkpoint " + checkpoint_file_ + " was written for a different input or number of events" );
+  if( checkpoint_prescale != prescale_ )
+    throw std::runtime_error( "TaskRunner: checkpoint " + checkpoint_file_ + " was written with a different prescale" );
+  WorkUnit unit{};
+  while( in >> unit.first_entry >> unit.last_entry )
+    restored_units_.push_back(unit);
+  // the histograms of the processed units are the start of the results
+  for( size_t v=0; v<variants_.size(); ++v ){
+    auto directory = file->GetDirectory(variants_[v].name.c_str());
+    if( !directory )
+      throw std::runtime_error( "TaskRunner: no variant " + variants_[v].name + " in checkpoint " + checkpoint_file_ );
+    results_.at(v)->Restore(directory);
+  }
+  file->Close();
+  std::cout << "TaskRunner: resuming from " << checkpoint_file_ << ", " << restored_units_.size()
+            << " work units are already processed" << std::endl;
+  return unit_size;
+}
+
+void TaskRunner::BindBranches(Worker &worker) const {
+  // nothing but the required branches is deserialized
+  worker.chain->SetBranchStatus("*", false);
+  for( const auto& name : AnalysisTask::GetRequiredBranches() ){
+    worker.chain->SetBranchStatus( name.c_str(), true );
+    worker.chain->SetBranchStatus( (name+".*").c_str(), true );
+    if( name == "event_header" ){
+      worker.event_header = new EventHeader;
+      worker.chain->SetBranchAddress(name.c_str(), &worker.event_header);
+      worker.branch_map.emplace(name, worker.event_header);
+      continue;
+    }
+    worker.payload_branch_names.push_back(name);
+    switch ( config_->GetBranchConfig(name).GetType() ) {
+    case DetType::kParticle: worker.Bind(name, worker.particles); break;
+    case DetType::kTrack: worker.Bind(name, worker.tracks); break;
+    case DetType::kHit: worker.Bind(name, worker.hits); break;
+    case DetType::kModule: worker.Bind(name, worker.modules); break;
+    default: throw std::runtime_error( "TaskRunner: branch " + name + " has unsupported type" );
+    }
+  }
+}
+
+TChain* TaskRunner::MakeChain() const {
+  auto chain = new TChain(tree_name_.c_str());
+  for( const auto& file_name : file_names_ )
+    chain->Add(file_name.c_str());
+  return chain;
+}
+
+void TaskRunner::Loop(Worker& worker, const WorkUnit& unit) const {
+#ifdef HADES_INSTRUMENTATION
+  auto stats = &worker.stage_stats;
+  // tracks are counted once per event here, not by each variant's task
+  auto mdc_vtx_tracks = static_cast<const Particles*>( worker.branch_map.at("mdc_vtx_tracks") );
+#endif
+  auto is_prescaled = prescale_ < 1.0;
+  auto file_key = file_keys_.at(unit.file);
+  auto is_indexed = is_event_index_ && is_file_indexed_.at(unit.file);
+  if( is_indexed ){
+    EventIndex index( EventIndex::GetFileName(file_names_.at(unit.file), index_dir_), unit.file_entries );
+    // the index must have been built for this very file, not for an earlier production with the same name
+    worker.chain->LoadTree(unit.first_entry);
+    auto file = worker.chain->GetFile();
+    is_indexed = index.IsValid() && file && index.GetInputId() == std::string( file->GetUUID().AsString() );
+    if( is_indexed )
+      index.Read( unit.first_entry-unit.file_offset, unit.last_entry-unit.first_entry, worker.index_values );
+    else
+      worker.n_stale_index_units++;
+  }
+  long long local_entry{0};
+  for( auto entry=unit.first_entry; entry<unit.last_entry; ++entry ){
+    // the entries skipped by the prescale are not read
+    if( is_prescaled && !IsSampled(file_key, entry-unit.file_offset, prescale_) )
+      continue;
+    worker.n_sampled++;
+    // nor the entries which fail the cuts of all the variants according to the index
+    if( is_indexed && !IsIndexCandidate(worker.index_values, entry-unit.first_entry) ){
+      worker.n_index_skipped++;
+      continue;
+    }
+    STAGE_START(stats);
+    if( !worker.LoadEventHeader(entry, local_entry) )
+      break;
+    STAGE_LAP(stats, READ_HEADER);
+    STAGE_COUNT(stats, n_events_read, 1);
+    auto is_any_selected{false};
+    for( size_t v=0; v<variants_.size(); ++v ){
+      worker.is_selected[v] = worker.event_selections[v].Apply(*worker.event_header);
+      is_any_selected = is_any_selected || worker.is_selected[v];
+    }
+    STAGE_LAP(stats, EVENT_CUTS);
+    if( !is_any_selected )
+      continue;
+    // the payload is read once for all the variants selecting the event
+    worker.LoadPayload(local_entry);
+    STAGE_LAP(stats, READ_PAYLOAD);
+    STAGE_COUNT(stats, n_events_selected, 1);
+    STAGE_COUNT(stats, n_tracks, mdc_vtx_tracks->GetNumberOfChannels());
+    for( size_t v=0; v<variants_.size(); ++v )
+      if( worker.is_selected[v] )
+        worker.tasks[v]->Exec();
+  }
+}
+
+bool TaskRunner::IsIndexCandidate(const EventIndex::Values &values, long long i) const {
+  for( const auto& checks : index_checks_ ){
+    auto is_passed = std::all_of( checks.begin(), checks.end(), [&values, i](const IndexCheck& check){
+      double value = values[check.field][i];
+      return !(value < check.min || value > check.max); // unknown values (NaN) pass
+    } );
+    if( is_passed )
+      return true;
+  }
+  return false;
+}
+
+void TaskRunner::WriteSamplingTags(double fraction, long long input_entries, long long sampled_entries) {
+  // the fraction is the same in all jobs of a run, the numbers of entries are summed when the outputs are merged
+  TParameter<double> sampling_fraction("sampling_fraction", fraction, 'f');
+  TParameter<double> input_entries_tag("input_entries", static_cast<double>(input_entries), '+');
+  TParameter<double> sampled_entries_tag("sampled_entries", static_cast<double>(sampled_entries), '+');
+  sampling_fraction.Write();
+  input_entries_tag.Write();
+  sampled_entries_tag.Write();
+}
+
+#ifdef HADES_INSTRUMENTATION
+void TaskRunner::PrintProgress(double elapsed_s) const {
+  uint64_t n_events_read{0};
+  uint64_t n_events_selected{0};
+  uint64_t n_tracks{0};
+  for( const auto& worker : workers_ ){
+    n_events_read+=worker->stage_stats.n_events_read.load(std::memory_order_relaxed);
+    n_events_selected+=worker->stage_stats.n_events_selected.load(std::memory_order_relaxed);
+    n_tracks+=worker->stage_stats.n_tracks.load(std::memory_order_relaxed);
+  }
+  std::cout << "TaskRunner: " << elapsed_s << " s, " << n_events_read << " events read, "
+            << n_events_selected << " selected, "
+            << n_events_read/elapsed_s << " events/s, " << n_tracks/elapsed_s << " tracks/s" << std::endl;
+}
+#endif
+
+} // namespace AnalysisTree
@@ -0,0 +1,234 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_TASK_RUNNER_H_
+#define HADES_CONTAMINATIONS_SRC_TASK_RUNNER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <TChain.h>
+
+#include <AnalysisTree/Configuration.hpp>
+#include "analysis_task.h"
+#include "event_cache.h"
+#include "event_index.h"
+#include "event_selection.h"
+
+namespace AnalysisTree {
+
+/* Runs AnalysisTask over the input chain in one or several threads.
+ * Each thread owns its chain, branch objects and AnalysisTask, so the event loop
+ * shares nothing but the (read-only) configuration and event cuts. The entries are split
+ * into work units: the files, and large files into ranges of entries. The threads take the units
+ * from a shared queue on demand in the order of entries, so files of different size do not leave threads idle.
+ * The tasks of the threads do not fill histograms: they keep the records of the events of the current unit
+ * (see AnalysisTask::EventStream), which are filled into one task per variant strictly in the order of the units.
+ * The output is therefore the same, bit by bit, for any number of threads and any assignment of units to them.
+ * Only the branches required by the task are enabled. The event header is read first,
+ * the other branches are read only for the events passing the event cuts.
+ * Several variants (event cuts, task and output file each) are evaluated in the same pass:
+ * an event is read once and passed to the tasks of the variants it is selected by. */
+class TaskRunner {
+public:
+  TaskRunner(std::string file_list, std::string tree_name) :
+      file_list_(std::move(file_list)), tree_name_(std::move(tree_name)) {}
+  ~TaskRunner();
+  struct Variant{
+    std::string name;
+    EventSelection event_selection; // copied for every thread
+    std::function<AnalysisTask*()> task_factory;
+    std::string out_file_name;
+  };
+  void AddVariant(Variant variant) { variants_.push_back(std::move(variant)); }
+  void SetNThreads(int n_threads) { n_threads_ = n_threads > 0 ? n_threads : 1; }
+  // writes the derived event values in the order of entries to <base>.0 for a later replay,
+  // <base>.<variant>.0 if there are several variants
+  void SetEventCacheFile(std::string base_name) { event_cache_file_ = std::move(base_name); }
+  // maximal number of entries in a work unit, 0 splits the entries into about 16 units per thread
+  void SetUnitSize(long long unit_size) { unit_size_ = unit_size; }
+  // the histograms and the list of processed work units are written to the file every interval_s seconds,
+  // the file is replaced atomically and removed after the output is written
+  void SetCheckpoint(std::string file_name, int interval_s) {
+    checkpoint_file_ = std::move(file_name);
+    checkpoint_interval_s_ = interval_s;
+  }
+  // continues the run from the checkpoint file if it exists
+  void SetResume(bool is_resume) { is_resume_ = is_resume; }
+  // files read ahead of the event loop in background and the limit of bytes read ahead, 0 files disables it
+  void SetReadAhead(size_t n_files, size_t budget) {
+    read_ahead_files_ = n_files;
+    read_ahead_budget_ = budget;
+  }
+  // size of the TTreeCache of each thread's chain in bytes, 0 keeps the ROOT default
+  void SetTreeCacheSize(long long cache_size) { tree_cache_size_ = cache_size; }
+  // adds the track and wall branches to the tree cache besides the event header. Their baskets are then prefetched
+  // and decompressed ahead also for the events rejected by the cuts, which pays off only for a high selection rate
+  void SetCachePayload(bool is_cache_payload) { is_cache_payload_ = is_cache_payload; }
+  // threads decompressing the baskets of the tree caches ahead of the event loop, 0 decompresses in the event loop
+  void SetUnzipThreads(int n_unzip_threads) { n_unzip_threads_ = n_unzip_threads; }
+  // reads first only the event header members used by the event selection, the rest for the selected events
+  void SetEarlyHeaderColumns(bool is_early_header_columns) { is_early_header_columns_ = is_early_header_columns; }
+  // processes a reproducible fraction of the entries spread uniformly over all the files, 1 processes all.
+  // An entry is taken if the hash of its file's name and its number in the file is below the fraction,
+  // the other entries are not read at all. The outputs are tagged with the fraction and the numbers of entries
+  void SetPrescale(double fraction) { prescale_ = fraction; }
+  // skips the entries which the index sidecars (see EventIndex) show to fail the cuts of every variant.
+  // The sidecars are looked for next to the input files, or in index_dir. Files without an index are read fully
+  void SetEventIndex(bool is_event_index, std::string index_dir) {
+    is_event_index_ = is_event_index;
+    index_dir_ = std::move(index_dir);
+  }
+  // how often the progress is printed when built with instrumentation
+  void SetProgressInterval(int seconds) { progress_interval_s_ = seconds; }
+  void Init();
+  void Run(long long n_events);
+  long long GetNEntries() const { return n_entries_; } // entries in the chain, known after Init()
+  void Finish();
+  // the prescale and the numbers of entries it was applied to and taken by it, to the current directory
+  static void WriteSamplingTags(double fraction, long long input_entries, long long sampled_entries);
+private:
+  struct Worker{
+    TChain* chain{nullptr};
+    EventHeader* event_header{nullptr};
+    // branch objects, deque keeps the addresses given to SetBranchAddress valid
+    std::deque<Particles*> particles;
+    std::deque<TrackDetector*> tracks;
+    std::deque<HitDetector*> hits;
+    std::deque<ModuleDetector*> modules;
+    std::map<std::string, void*> branch_map;
+    std::vector<std::string> payload_branch_names; // read after the event cuts
+    int tree_number{-1}; // tree of the chain the branch pointers below belong to
+    TBranch* event_header_branch{nullptr};
+    std::vector<TBranch*> payload_branches;
+    std::vector<AnalysisTask*> tasks; // one per variant
+    std::vector<AnalysisTask::EventStream> streams; // per variant, the events of the current unit selected by it
+    std::vector<EventSelection> event_selections; // one per variant
+    std::vector<char> is_selected; // per variant, for the current event
+    std::vector<std::string> header_columns; // event header members read before the event selection, all if empty
+    std::vector<TBranch*> header_branches; // sub-branches of the event header with these members
+    std::vector<TBranch*> header_rest_branches; // the other sub-branches, read after the selection
+    long long n_sampled{0}; // entries taken by the prescale in the current unit
+    long long n_index_skipped{0}; // entries rejected with the event index
+    long long n_stale_index_units{0}; // units read fully because their file changed after the index was built
+    EventIndex::Values index_values; // of the current work unit
+#ifdef HADES_INSTRUMENTATION
+    StageStats stage_stats;
+#endif
+    template<typename T>
+    void Bind(const std::string& name, std::deque<T*>& objects){
+      objects.push_back(new T);
+      chain->SetBranchAddress(name.c_str(), &objects.back());
+      branch_map.emplace(name, objects.back());
+    }
+    // returns false if the entry does not exist
+    bool LoadEventHeader(long long entry, long long& local_entry);
+    void LoadPayload(long long local_entry);
+    void SplitHeaderBranch();
+  };
+  struct WorkUnit{
+    long long first_entry;
+    long long last_entry;
+    int file; // index in the file list
+    long long file_offset; // entry of the chain the file starts with
+    long long file_entries;
+  };
+  // cut on a field of the event index
+  struct IndexCheck{
+    int field;
+    double min;
+    double max;
+  };
+  // pauses the threads at the work unit boundaries while a checkpoint is written
+  struct CheckpointSync{
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::chrono::steady_clock::time_point next_time;
+    int n_running{0};
+    int n_paused{0};
+    bool is_requested{false};
+    bool is_failed{false}; // a worker failed in the middle of a unit, its histograms must not be checkpointed
+    long long generation{0};
+  };
+  // what a thread hands over for a processed unit, counted only once the unit is filled
+  struct FinishedUnit{
+    std::vector<AnalysisTask::EventStream> streams; // per variant
+    long long n_sampled;
+  };
+  // hands the record streams of the finished units to the result tasks in the order of the units.
+  // A thread does not start a unit more than window units ahead of the next one to be filled,
+  // so a slow unit does not let the streams of the following ones pile up in memory
+  struct FillSequence{
+    std::mutex mutex;
+    std::condition_variable condition; // notified when a unit is filled or the run is aborted
+    std::map<size_t, FinishedUnit> pending; // waiting for the previous units
+    size_t next_unit{0}; // the unit to be filled next
+    size_t window{1};
+    bool is_filling{false}; // a thread is filling, the others leave their streams in pending
+    bool is_aborted{false}; // a worker failed, the units after its one are never filled
+  };
+  std::vector<WorkUnit> MakeWorkUnits(long long n_events, long long unit_size) const;
+  void SyncCheckpoint(CheckpointSync& sync, const std::vector<WorkUnit>& units, const std::vector<char>& is_done,
+                      bool is_leaving, bool is_failed = false) const;
+  void WriteCheckpoint(const std::vector<WorkUnit>& units, const std::vector<char>& is_done) const;
+  long long ReadCheckpoint(long long n_events, long long unit_size); // returns the unit size of the checkpointed run
+  TChain* MakeChain() const;
+  void BindBranches(Worker& worker) const;
+  void InitEventIndex();
+  void Loop(Worker& worker, const WorkUnit& unit) const;
+  // adds the streams of the unit to the pending ones and fills all the pending units which are next in order,
+  // unless another thread is filling them already. The filled units are marked done
+  void FillInOrder(FillSequence& sequence, size_t unit, FinishedUnit finished, std::vector<char>& is_done);
+  // waits until the unit is within the window, returns false if the run is aborted
+  bool WaitForFillWindow(FillSequence& sequence, size_t unit) const;
+  void AbortFill(FillSequence& sequence) const; // wakes the threads waiting for the window
+  bool IsIndexCandidate(const EventIndex::Values& values, long long i) const; // may pass the cuts of any variant
+#ifdef HADES_INSTRUMENTATION
+  void PrintProgress(double elapsed_s) const;
+#endif
+
+  std::string file_list_;
+  std::string tree_name_;
+  std::string event_cache_file_;
+  std::vector<std::string> file_names_;
+  int n_threads_{1};
+  long long n_entries_{0};
+  long long unit_size_{0};
+  size_t read_ahead_files_{0};
+  size_t read_ahead_budget_{0};
+  long long tree_cache_size_{0};
+  int n_unzip_threads_{0};
+  bool is_cache_payload_{false};
+  bool is_early_header_columns_{false};
+  std::string checkpoint_file_;
+  int checkpoint_interval_s_{1800};
+  bool is_resume_{false};
+  long long n_events_{0}; // of the current run
+  long long run_unit_size_{0};
+  std::vector<WorkUnit> restored_units_; // processed before the checkpoint the run is resumed from
+  long long n_sampled_{0}; // entries taken by the prescale in the filled units and before the checkpoint
+  double prescale_{1.0};
+  std::vector<uint64_t> file_keys_; // hashes of the files' names for the prescale
+  bool is_event_index_{false};
+  std::string index_dir_;
+  std::vector<std::vector<IndexCheck>> index_checks_; // per variant, the cuts on the indexed fields
+  std::vector<char> is_file_indexed_; // per file, the file has an up-to-date index
+  int progress_interval_s_{60};
+  double wall_time_s_{0.0};
+  std::vector<Variant> variants_;
+  std::unique_ptr<Configuration> config_; // read from the first file, shared by the tasks of all threads
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::unique_ptr<AnalysisTask>> results_; // one per variant, the histograms of the processed units
+  std::vector<std::shared_ptr<EventCacheWriter>> event_caches_;
+};
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_TASK_RUNNER_H_
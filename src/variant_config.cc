@@ -0,0 +1,101 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include "variant_config.h"
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace AnalysisTree {
+
+std::vector<VariantConfig> ReadVariantConfigs(const std::string &file_name) {
+  std::ifstream in(file_name);
+  if( !in )
+    throw std::runtime_error( "Cannot open variants file " + file_name );
+  std::vector<VariantConfig> configs;
+  std::set<std::string> names;
+  std::string line;
+  int line_number{0};
+  while( std::getline(in, line) ){
+    line_number++;
+    std::istringstream tokens(line);
+    std::string token;
+    if( !(tokens >> token) || token.front() == '#' )
+      continue;
+    VariantConfig config;
+    config.name.clear();
+    auto where = file_name + ":" + std::to_string(line_number);
+    do {
+      auto separator = token.find('=');
+      if( separator == std::string::npos )
+        throw std::runtime_error( where + ": " + token + " is not a key=value pair" );
+      auto key = token.substr(0, separator);
+      auto value = token.substr(separator+1);
+      if( key == "name" )
+        config.name = value;
+      else if( key == "trigger" ){
+        size_t n_parsed{0};
+        try {
+          config.physical_trigger = std::stoi(value, &n_parsed);
+        } catch (std::exception&) {
+          n_parsed = 0;
+        }
+        // the line names the variant, which may be given after the trigger
+        if( n_parsed == 0 || n_parsed != value.size() )
+          throw std::runtime_error( where + ": trigger " + value + " is not a number in \"" + line + "\"" );
+      }
+      else if( key == "vertex" ){
+        if( value != "target" && value != "start" )
+          throw std::runtime_error( where + R"(: only "target" or "start" vertex is expected)" );
+        config.is_in_start = value == "start";
+      }
+      else if( key == "efficiency" )
+        config.efficiency_file = value;
+      else if( key == "output" )
+        config.output_dir = value;
+      else if( key == "cuts" ){
+        try {
+          EventSelection::Parse(value);
+        } catch (std::exception& e) {
+          throw std::runtime_error( where + ": " + e.what() );
+        }
+        config.cuts = value;
+      }
+      else
+        throw std::runtime_error( where + ": unknown key " + key );
+    } while( tokens >> token );
+    if( config.name.empty() )
+      throw std::runtime_error( where + ": variant has no name" );
+    if( !names.insert(config.name).second )
+      throw std::runtime_error( where + ": variant " + config.name + " is defined twice" );
+    if( config.physical_trigger != 2 && config.physical_trigger != 3 && config.physical_trigger != 0 )
+      throw std::runtime_error( where + R"(: only "2" or "3" physical trigger is expected)" );
+    if( config.efficiency_file.empty() )
+      throw std::runtime_error( where + ": variant " + config.name + " has no efficiency file" );
+    if( config.output_dir.empty() )
+      config.output_dir = config.name;
+    configs.push_back(config);
+  }
+  if( configs.empty() )
+    throw std::runtime_error( "No variants in " + file_name );
+  return configs;
+}
+
+EventSelection MakeEventSelection(const VariantConfig &config) {
+  if( !config.cuts.empty() )
+    return EventSelection( config.name, EventSelection::Parse(config.cuts) );
+  std::vector<EventSelection::Cut> cuts;
+  cuts.push_back( {"selected_mdc_tracks", 2.0, 999.0} );
+  if( config.physical_trigger != 0 )
+    cuts.push_back( {"physical_trigger_"+std::to_string(config.physical_trigger), 1.0, 1.0} );
+  if( !config.is_in_start )
+    cuts.push_back( {"vtx_z", -70.0, -5.0} );
+  else
+    cuts.push_back( {"vtx_z", -90.0, -70.0} );
+  return EventSelection( config.name, cuts );
+}
+
+} // namespace AnalysisTree
@@ -0,0 +1,34 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#ifndef HADES_CONTAMINATIONS_SRC_VARIANT_CONFIG_H_
+#define HADES_CONTAMINATIONS_SRC_VARIANT_CONFIG_H_
+
+#include <string>
+#include <vector>
+
+#include "event_selection.h"
+
+namespace AnalysisTree {
+
+/* Settings of one analysis variant: event selection, protons efficiency and the output directory.
+ * Several variants are run over the same input in one pass. They are listed in a text file,
+ * one variant per line as key=value pairs, lines starting with # are comments:
+ *   name=agag efficiency=efficiency/efficiency_protons_agag158.root
+ *   name=au_x trigger=2 vertex=start efficiency=efficiency/efficiency_protons_auau123.root output=au_x
+ *   name=wide cuts=selected_mdc_tracks=2:999,vtx_z=-80:0 efficiency=efficiency/efficiency_protons_agag158.root */
+struct VariantConfig{
+  std::string name{"default"};
+  int physical_trigger{0}; // 0 is any trigger
+  bool is_in_start{false}; // vertex in the START detector instead of the target
+  std::string efficiency_file;
+  std::string output_dir; // the output file is written there, the current directory if empty
+  std::string cuts; // event cuts in the EventSelection::Parse() format, replace the trigger and vertex cuts if set
+};
+
+std::vector<VariantConfig> ReadVariantConfigs(const std::string& file_name);
+EventSelection MakeEventSelection(const VariantConfig& config);
+
+} // namespace AnalysisTree
+#endif // HADES_CONTAMINATIONS_SRC_VARIANT_CONFIG_H_
@@ -0,0 +1,75 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <TH1.h>
+#include <TMemFile.h>
+
+#include "analysis_task.h"
+
+namespace {
+using Task = AnalysisTree::AnalysisTask;
+using Mode = AnalysisTree::BootstrapProfile::MODE;
+
+// reads the histogram written by Task::Finish() to the file, nullptr if it is missing
+std::unique_ptr<TH1> Read(TMemFile& file, const std::string& name){
+  TH1* histo{nullptr};
+  file.GetObject(name.c_str(), histo);
+  if( !histo )
+    std::cout << "FAIL: " << name << " is not written" << std::endl;
+  return std::unique_ptr<TH1>(histo);
+}
+
+// events without protons carry kUndefinedValue as <y_cm>. It must not enter the bootstrap means,
+// nor the in-range bins of the correlation matrices. Returns the number of failed checks
+int CheckUndefinedTrackValues(Mode mode){
+  auto mode_name = std::string( AnalysisTree::BootstrapProfile::GetModeName(mode) );
+  Task task;
+  task.SetBootstrap(4, mode);
+  task.InitHistograms();
+  Task::EventRecord event{};
+  event.multiplicities.fill(10);
+  event.track_values.fill(0.5f);
+  event.erat = 0.5;
+  event.mean_ycm = 0.5;
+  event.n_tracks = 10;
+  task.FillEvent(event, nullptr);
+  auto without_protons = event;
+  without_protons.track_values[Task::Idx(Task::TRACK_VALUES::MEAN_YCM)] = Task::kUndefinedValue;
+  without_protons.mean_ycm = Task::kUndefinedValue;
+  task.FillEvent(without_protons, nullptr);
+  TMemFile file( ("undefined_values_" + mode_name + ".root").c_str(), "recreate" );
+  file.cd();
+  task.Finish();
+
+  int n_failed{0};
+  auto estimate = Read(file, "tracks_mdc_mean_protons_ycm_bootstrap");
+  if( !estimate || estimate->GetBinContent( estimate->FindBin(10.0) ) != 0.5 ){
+    std::cout << "FAIL: " << mode_name << ": the <y_cm> bootstrap mean includes the event without protons" << std::endl;
+    n_failed++;
+  }
+  // the undefined value is below every <y_cm> axis, only the event with protons is in range
+  for( const auto& name : { std::string("tracks_mdc_mean_protons_ycm"), std::string("mean_protons_ycm_erat") } ){
+    auto matrix = Read(file, name);
+    if( !matrix || matrix->Integral() != 1.0 ){
+      std::cout << "FAIL: " << mode_name << ": " << name << " has the event without protons in range" << std::endl;
+      n_failed++;
+    }
+  }
+  file.Close();
+  return n_failed;
+}
+} // namespace
+
+int main(){
+  TH1::AddDirectory(kFALSE);
+  auto n_failed = CheckUndefinedTrackValues(Mode::POISSON) + CheckUndefinedTrackValues(Mode::SUBSAMPLE);
+  if( n_failed > 0 )
+    return 1;
+  std::cout << "undefined values: OK" << std::endl;
+  return 0;
+}
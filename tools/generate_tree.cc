@@ -0,0 +1,211 @@
+//
+// Created by mikhail on 10/17/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <boost/program_options.hpp>
+
+#include <TFile.h>
+#include <TRandom3.h>
+#include <TTree.h>
+#include <TVector3.h>
+
+#include <AnalysisTree/Configuration.hpp>
+#include <AnalysisTree/Detector.hpp>
+#include <AnalysisTree/EventHeader.hpp>
+#include <AnalysisTree/Matching.hpp>
+
+/* Writes a synthetic hades_analysis_tree with the branches and fields the analysis reads,
+ * so the performance and the output of analyse can be checked without the experimental data.
+ * The distributions are only roughly HADES-like: they are meant to exercise all code paths
+ * (protons inside and outside the efficiency acceptance, events failing each cut), not to be physics. */
+
+namespace {
+
+struct Species{
+  int pid;
+  int geant_pid;
+  double mass;
+  double fraction;
+};
+
+// particle composition of the tracks, fractions are cumulated while sampling
+constexpr Species kSpecies[] = {
+    { 2212, 14, 0.938272, 0.45 },      // protons
+    { 211, 8, 0.139570, 0.20 },        // pi+
+    { -211, 9, 0.139570, 0.25 },       // pi-
+    { 321, 11, 0.493677, 0.02 },       // K+
+    { 1000010020, 45, 1.875613, 0.05 }, // deuterons
+    { 1000020030, 49, 2.808391, 0.03 }, // helium-3
+};
+constexpr double kBeamRapidity = 0.74;
+
+const Species& SampleSpecies(TRandom3& random){
+  auto u = random.Uniform();
+  for( const auto& species : kSpecies ){
+    if( u < species.fraction )
+      return species;
+    u-=species.fraction;
+  }
+  return kSpecies[0];
+}
+
+} // namespace
+
+int main(int n_args, char** args){
+  namespace po=boost::program_options;
+  std::string output_file{"synthetic.root"};
+  long long n_events{10000};
+  double mean_tracks{30.0};
+  double mean_wall_hits{20.0};
+  unsigned seed{42};
+  po::options_description options("Options");
+  options.add_options()
+      ("help,h", "Help screen")
+      ("output,o", po::value<std::string>(&output_file),
+       "output file name")
+      ("n-events,N", po::value<long long>(&n_events),
+       "Number of events to generate")
+      ("tracks", po::value<double>(&mean_tracks),
+       "Mean number of MDC tracks per event")
+      ("wall-hits", po::value<double>(&mean_wall_hits),
+       "Mean number of forward wall hits per event")
+      ("seed", po::value<unsigned>(&seed),
+       "Seed of the random generator, the same seed gives the same file");
+  po::variables_map vm;
+  po::store(po::command_line_parser(n_args, args).options(options).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")){
+    std::cout << options << std::endl;
+    return 0;
+  }
+  if( n_events <= 0 || mean_tracks <= 0.0 || mean_wall_hits < 0.0 )
+    throw std::runtime_error( "Number of events and mean number of tracks must be positive" );
+
+  using namespace AnalysisTree;
+  BranchConfig event_header_config("event_header", DetType::kEventHeader);
+  event_header_config.AddField<int>("selected_tof_hits");
+  event_header_config.AddField<int>("selected_rpc_hits");
+  event_header_config.AddField<int>("selected_mdc_tracks");
+  event_header_config.AddField<int>("fw_adc");
+  event_header_config.AddField<int>("physical_trigger_2");
+  event_header_config.AddField<int>("physical_trigger_3");
+  event_header_config.AddField<float>("selected_tof_rpc_hits_centrality");
+  BranchConfig tracks_config("mdc_vtx_tracks", DetType::kParticle);
+  tracks_config.AddField<float>("chi2");
+  tracks_config.AddField<float>("dca_xy");
+  tracks_config.AddField<float>("dca_z");
+  tracks_config.AddField<int>("geant_pid");
+  BranchConfig meta_hits_config("meta_hits", DetType::kHit);
+  meta_hits_config.AddField<float>("beta");
+  meta_hits_config.AddField<float>("mass2");
+  BranchConfig wall_hits_config("forward_wall_hits", DetType::kHit);
+  wall_hits_config.AddField<int>("ring");
+
+  Configuration config("Configuration");
+  config.AddBranchConfig(event_header_config);
+  config.AddBranchConfig(tracks_config);
+  config.AddBranchConfig(meta_hits_config);
+  config.AddBranchConfig(wall_hits_config);
+  config.AddMatch("mdc_vtx_tracks", "meta_hits", "mdc_vtx_tracks2meta_hits");
+
+  auto hits_tof_id = event_header_config.GetFieldId("selected_tof_hits");
+  auto hits_rpc_id = event_header_config.GetFieldId("selected_rpc_hits");
+  auto tracks_mdc_id = event_header_config.GetFieldId("selected_mdc_tracks");
+  auto fw_adc_id = event_header_config.GetFieldId("fw_adc");
+  auto pt2_id = event_header_config.GetFieldId("physical_trigger_2");
+  auto pt3_id = event_header_config.GetFieldId("physical_trigger_3");
+  auto centrality_id = event_header_config.GetFieldId("selected_tof_rpc_hits_centrality");
+  auto chi2_id = tracks_config.GetFieldId("chi2");
+  auto dca_xy_id = tracks_config.GetFieldId("dca_xy");
+  auto dca_z_id = tracks_config.GetFieldId("dca_z");
+  auto geant_pid_id = tracks_config.GetFieldId("geant_pid");
+  auto beta_id = meta_hits_config.GetFieldId("beta");
+  auto mass2_id = meta_hits_config.GetFieldId("mass2");
+  auto ring_id = wall_hits_config.GetFieldId("ring");
+
+  auto file = TFile::Open(output_file.c_str(), "recreate");
+  if( !file || file->IsZombie() )
+    throw std::runtime_error( "Cannot create " + output_file );
+  auto tree = new TTree("hades_analysis_tree", "Synthetic HADES events");
+  auto event_header = new EventHeader( event_header_config.GetId() );
+  auto mdc_vtx_tracks = new Particles( tracks_config.GetId() );
+  auto meta_hits = new HitDetector( meta_hits_config.GetId() );
+  auto wall_hits = new HitDetector( wall_hits_config.GetId() );
+  auto mdc_meta_matching = new Matching( tracks_config.GetId(), meta_hits_config.GetId() );
+  event_header->Init(event_header_config);
+  tree->Branch("event_header", &event_header);
+  tree->Branch("mdc_vtx_tracks", &mdc_vtx_tracks);
+  tree->Branch("meta_hits", &meta_hits);
+  tree->Branch("forward_wall_hits", &wall_hits);
+  tree->Branch("mdc_vtx_tracks2meta_hits", &mdc_meta_matching);
+
+  TRandom3 random(seed);
+  for( long long event=0; event<n_events; ++event ){
+    mdc_vtx_tracks->ClearChannels();
+    meta_hits->ClearChannels();
+    wall_hits->ClearChannels();
+    mdc_meta_matching->Clear();
+
+    auto n_tracks = random.Poisson(mean_tracks);
+    // most of the vertices are in the target, a tail goes into the START detector region and outside of it
+    auto vtx_z = random.Uniform() < 0.85 ? random.Uniform(-65.0, -5.0) : random.Uniform(-100.0, 20.0);
+    event_header->SetVertexPosition3( TVector3( random.Gaus(0.0, 1.0), random.Gaus(0.0, 1.0), vtx_z ) );
+    event_header->SetField( int(random.Poisson(0.4*n_tracks)), hits_tof_id );
+    event_header->SetField( int(random.Poisson(0.6*n_tracks)), hits_rpc_id );
+    event_header->SetField( int(n_tracks), tracks_mdc_id );
+    event_header->SetField( 1, pt2_id );
+    event_header->SetField( random.Uniform() < 0.8 ? 1 : 0, pt3_id );
+    // centrality decreases with the multiplicity and covers the classes of the efficiency tables with a margin
+    auto centrality = std::max( 0.0, 65.0*( 1.0 - n_tracks/(2.5*mean_tracks) ) + random.Gaus(0.0, 2.0) );
+    event_header->SetField( float(centrality), centrality_id );
+
+    for( int i=0; i<n_tracks; ++i ){
+      const auto& species = SampleSpecies(random);
+      auto rapidity = random.Gaus(kBeamRapidity, 0.45);
+      auto pt = random.Exp(0.35);
+      auto phi = random.Uniform(-M_PI, M_PI);
+      auto mt = std::sqrt( pt*pt + species.mass*species.mass );
+      auto& track = mdc_vtx_tracks->AddChannel();
+      track.Init(tracks_config);
+      track.SetMomentum( float(pt*std::cos(phi)), float(pt*std::sin(phi)), float(mt*std::sinh(rapidity)) );
+      track.SetPid(species.pid);
+      track.SetMass( float(species.mass) );
+      track.SetField( float(random.Exp(10.0)), chi2_id );
+      track.SetField( float(random.Gaus(0.0, 4.0)), dca_xy_id );
+      track.SetField( float(random.Gaus(0.0, 4.0)), dca_z_id );
+      track.SetField( species.geant_pid, geant_pid_id );
+
+      auto p = std::sqrt( pt*pt + mt*mt*std::sinh(rapidity)*std::sinh(rapidity) );
+      auto beta = p / std::sqrt( p*p + species.mass*species.mass );
+      auto& hit = meta_hits->AddChannel();
+      hit.Init(meta_hits_config);
+      hit.SetPosition( float(random.Gaus(0.0, 500.0)), float(random.Gaus(0.0, 500.0)), float(random.Uniform(2000.0, 2500.0)) );
+      hit.SetSignal( float(random.Exp(2.0)) );
+      hit.SetField( float(beta), beta_id );
+      hit.SetField( float(species.mass*species.mass), mass2_id );
+      mdc_meta_matching->AddMatch(i, i);
+    }
+
+    auto n_wall_hits = random.Poisson(mean_wall_hits);
+    double fw_adc{0.0};
+    for( int i=0; i<n_wall_hits; ++i ){
+      auto signal = random.Exp(80.0);
+      fw_adc+=signal;
+      auto& hit = wall_hits->AddChannel();
+      hit.Init(wall_hits_config);
+      hit.SetPosition( float(random.Uniform(-900.0, 900.0)), float(random.Uniform(-900.0, 900.0)), 6950.0f );
+      hit.SetSignal( float(signal) );
+      hit.SetField( int(random.Integer(10))+1, ring_id );
+    }
+    event_header->SetField( int(fw_adc), fw_adc_id );
+    tree->Fill();
+  }
+  config.Write("Configuration");
+  tree->Write();
+  file->Close();
+  std::cout << n_events << " events written to " << output_file << std::endl;
+  return 0;
+}